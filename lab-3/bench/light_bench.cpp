@@ -0,0 +1,101 @@
+// Tiled light culling: light list build time, then the lighting of every pixel of a floor seen at a
+// low angle, with each pixel's tile list against a loop over every light. Both give the same sums.
+
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+#include "camera.h"
+#include "light_grid.h"
+#include "our_gl.h"
+
+// Positions through one transform, into a DepthBuffer
+struct FloorShader {
+    static constexpr bool never_discards = true;
+    static constexpr bool depth_only     = true;
+
+    mat4              clip_from_world;
+    std::vector<vec4> positions;
+
+    void draw_setup() {}
+    [[nodiscard]] vec4 vertex(const int vert) const { return clip_from_world * positions[vert]; }
+    void triangle_setup(int /*face*/) {}
+};
+
+template <typename F>
+static double milliseconds(F &&f) {
+    const auto start = std::chrono::steady_clock::now();
+    f();
+    const auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+int main() {
+    constexpr int width = 640, height = 360;
+    Camera camera({0, 1.5, 4}, {0, 0, 0}, {0, 1, 0}, 4.3);
+    camera.init_viewport(0, 0, width, height);
+
+    FloorShader floor{camera.perspective() * camera.model_view(), {{-20, 0, -20, 1}, {20, 0, -20, 1}, {20, 0, 20, 1}, {-20, 0, 20, 1}}};
+    const std::vector<int> indices = {0, 2, 1, 0, 3, 2};
+    DepthBuffer    depth(width, height);
+    TileRasterizer rasterizer(width, height, camera.viewport());
+    rasterizer.set_cull_backfaces(false);
+    rasterizer.draw(floor, 4, indices, depth);
+
+    // View-space position and normal of every covered pixel
+    const mat4  view_from_screen = (camera.viewport() * camera.perspective()).invert();
+    const vec3f normal = vec_cast<float>(normalized((camera.model_view() * vec4{0, 1, 0, 0}).xyz()));
+    std::vector<int>   pixels;
+    std::vector<vec3f> positions;
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++) {
+            const double z = depth.z[x + y * width];
+            if (z == Gl_Globals::CLEAR_DEPTH) continue;
+            const vec4 p = view_from_screen * vec4{static_cast<double>(x), static_cast<double>(y), z, 1.};
+            pixels.push_back(x + y * width);
+            positions.push_back(vec_cast<float>((p / p.w).xyz()));
+        }
+
+    Aabb box;
+    box.expand({-20, 0, -20});
+    box.expand({20, 2, 20});
+
+    LightGrid grid(width, height);
+    for (const int count: {1, 16, 256, 1024}) {
+        const std::vector<Light> lights = scatter_lights(count, box);
+
+        double build_ms = 1e30;
+        for (int run = 0; run < 5; run++)
+            build_ms = std::min(build_ms, milliseconds([&] { grid.build(lights, camera, &depth); }));
+
+        std::vector<vec3f> tiled(pixels.size()), all(pixels.size());
+        long long listed = 0;
+        const double tiled_ms = milliseconds([&] {
+            for (size_t p = 0; p < pixels.size(); p++) {
+                vec3f diffuse = {0, 0, 0}, specular = {0, 0, 0};
+                const ArrayView<int> list = grid.lights_at(pixels[p] % width, pixels[p] / width);
+                for (const int i: list)
+                    accumulate_light(grid.light(i), positions[p], normal, diffuse, specular);
+                tiled[p] = diffuse + specular;
+                listed += static_cast<long long>(list.size());
+            }
+        });
+        const double all_ms = milliseconds([&] {
+            for (size_t p = 0; p < pixels.size(); p++) {
+                vec3f diffuse = {0, 0, 0}, specular = {0, 0, 0};
+                for (int i = 0; i < count; i++)
+                    accumulate_light(grid.light(i), positions[p], normal, diffuse, specular);
+                all[p] = diffuse + specular;
+            }
+        });
+
+        size_t mismatches = 0;
+        for (size_t p = 0; p < pixels.size(); p++)
+            mismatches += tiled[p].x != all[p].x || tiled[p].y != all[p].y || tiled[p].z != all[p].z;
+
+        std::printf("%5d lights  build %6.2f ms  %7.1f lights/pixel  tiled %8.2f ms  all %8.2f ms  (%5.1fx)  mismatches %zu\n",
+                    count, build_ms, static_cast<double>(listed) / static_cast<double>(pixels.size()), tiled_ms, all_ms,
+                    all_ms / tiled_ms, mismatches);
+    }
+    return 0;
+}
@@ -0,0 +1,119 @@
+// Closed-form mat2/3/4 determinant and inverse against recursive cofactor expansion.
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "math/mat.h"
+
+// The generic path: Laplace expansion along the first row, recursing down to 1x1.
+template <int N>
+static double reference_det(const mat<N, N> &m);
+
+template <int N>
+static double reference_cofactor(const mat<N, N> &m, const int row, const int col) {
+    mat<N - 1, N - 1> sub;
+    for (int i = 0, si = 0; i < N; ++i) {
+        if (i == row) continue;
+        for (int j = 0, sj = 0; j < N; ++j) {
+            if (j == col) continue;
+            sub[si][sj++] = m[i][j];
+        }
+        ++si;
+    }
+    return ((row + col) % 2 ? -1. : 1.) * reference_det(sub);
+}
+
+template <int N>
+static double reference_det(const mat<N, N> &m) {
+    if constexpr (N == 1) {
+        return m[0].data[0];
+    } else {
+        double ret = 0;
+        for (int i = 0; i < N; ++i)
+            ret += m[0][i] * reference_cofactor(m, 0, i);
+        return ret;
+    }
+}
+
+template <int N>
+static mat<N, N> reference_invert_transpose(const mat<N, N> &m) {
+    mat<N, N> adjugate_transpose;
+    for (int i = 0; i < N; ++i)
+        for (int j = 0; j < N; ++j)
+            adjugate_transpose[i][j] = reference_cofactor(m, i, j);
+    return adjugate_transpose / (adjugate_transpose[0] * m[0]);
+}
+
+template <int N>
+static std::vector<mat<N, N>> random_matrices(const int count) {
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<double> dist(-1., 1.);
+    std::vector<mat<N, N>> ret(count);
+    for (mat<N, N> &m: ret) {
+        for (int i = 0; i < N; ++i)
+            for (int j = 0; j < N; ++j)
+                m[i][j] = dist(rng) + (i == j ? 2. : 0.);
+    }
+    return ret;
+}
+
+template <typename F>
+static double time_ns(const int count, F &&f) {
+    const auto start = std::chrono::steady_clock::now();
+    f();
+    const auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / count;
+}
+
+template <int N>
+static void run(const int count) {
+    const std::vector<mat<N, N>> input = random_matrices<N>(count);
+    volatile double sink = 0;
+
+    const double det_ref = time_ns(count, [&] { for (const auto &m: input) sink = sink + reference_det(m); });
+    const double det_new = time_ns(count, [&] { for (const auto &m: input) sink = sink + m.det(); });
+    const double inv_ref = time_ns(count, [&] { for (const auto &m: input) sink = sink + reference_invert_transpose(m)[0][0]; });
+    const double inv_new = time_ns(count, [&] { for (const auto &m: input) sink = sink + m.invert_transpose()[0][0]; });
+
+    double max_err = 0;
+    for (const auto &m: input) {
+        const mat<N, N> a = reference_invert_transpose(m), b = m.invert_transpose();
+        for (int i = 0; i < N; ++i)
+            for (int j = 0; j < N; ++j)
+                max_err = std::max(max_err, std::abs(a[i][j] - b[i][j]));
+        max_err = std::max(max_err, std::abs(reference_det(m) - m.det()));
+    }
+
+    std::printf("mat%d  det %7.1f -> %5.1f ns  invert_transpose %7.1f -> %5.1f ns  max |diff| %.2e\n",
+                N, det_ref, det_new, inv_ref, inv_new, max_err);
+}
+
+int main() {
+    // Compile-time evaluation of the closed forms
+    constexpr mat4 translate = [] {
+        mat4 m;
+        m[0] = {1, 0, 0, 3};
+        m[1] = {0, 2, 0, -1};
+        m[2] = {0, 0, 4, 5};
+        m[3] = {0, 0, 0, 1};
+        return m;
+    }();
+    static_assert(translate.det() == 8.);
+    static_assert(affine_inverse(translate)[0].w == -3.);
+    static_assert(translate.invert()[2].w == -1.25);
+
+    constexpr int count = 200000;
+    run<2>(count);
+    run<3>(count);
+    run<4>(count);
+
+    const std::vector<mat4> input = random_matrices<4>(count);
+    volatile double sink = 0;
+    const double general = time_ns(count, [&] { for (const auto &m: input) sink = sink + m.invert()[0][3]; });
+    const double affine  = time_ns(count, [&] { for (const auto &m: input) sink = sink + affine_inverse(m)[0][3]; });
+    std::printf("mat4  invert %5.1f ns  affine_inverse %5.1f ns\n", general, affine);
+    return 0;
+}
@@ -0,0 +1,92 @@
+// Shadow ray throughput of the BVH: one ray per point of a grid on a floor, towards a directional
+// light, under a field of tessellated spheres. Rays are traced one at a time and as 2x2 packets.
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#include "bvh.h"
+
+static void add_sphere(std::vector<BvhTriangle> &triangles, const vec3f &center, const float radius, const int segments) {
+    auto point = [&](const int i, const int j) {
+        const float theta = 3.14159265f * static_cast<float>(i) / static_cast<float>(segments);
+        const float phi   = 6.2831853f * static_cast<float>(j) / static_cast<float>(2 * segments);
+        return center + vec3f{std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi)} * radius;
+    };
+    for (int i = 0; i < segments; i++)
+        for (int j = 0; j < 2 * segments; j++) {
+            const vec3f a = point(i, j), b = point(i + 1, j), c = point(i + 1, j + 1), d = point(i, j + 1);
+            triangles.push_back({a, b - a, c - a});
+            triangles.push_back({a, c - a, d - a});
+        }
+}
+
+template <typename F>
+static double mrays_per_s(const size_t count, F &&f) {
+    const auto start = std::chrono::steady_clock::now();
+    f();
+    const auto end = std::chrono::steady_clock::now();
+    return static_cast<double>(count) / std::chrono::duration<double, std::micro>(end - start).count();
+}
+
+static void run(const int grid, const int segments) {
+    std::vector<BvhTriangle> triangles;
+    for (int i = 0; i < grid; i++)
+        for (int j = 0; j < grid; j++)
+            add_sphere(triangles, {static_cast<float>(i) - grid * .5f, .6f, static_cast<float>(j) - grid * .5f}, .4f, segments);
+
+    const auto start = std::chrono::steady_clock::now();
+    const Bvh bvh(triangles);
+    const auto end = std::chrono::steady_clock::now();
+
+    // Origins: a 1024x1024 grid on the floor under the spheres, walked in 2x2 quads
+    constexpr int size = 1024;
+    const vec3f dir = normalized(vec3f{1, 1, 1});
+    auto origin = [&](const int x, const int y) {
+        return vec3f{(static_cast<float>(x) / size - .5f) * grid, 0.f, (static_cast<float>(y) / size - .5f) * grid};
+    };
+
+    std::vector<unsigned char> single(static_cast<size_t>(size) * size), packed(single.size());
+    const double single_rate = mrays_per_s(single.size(), [&] {
+        for (int y = 0; y < size; y++)
+            for (int x = 0; x < size; x++)
+                single[x + y * size] = bvh.occluded(origin(x, y), dir, 1e-4f, 1e30f);
+    });
+    const double packet_rate = mrays_per_s(packed.size(), [&] {
+        for (int y = 0; y < size; y += 2)
+            for (int x = 0; x < size; x += 2) {
+                RayPacket p;
+                p.dir    = dir;
+                p.tmin   = 1e-4f;
+                p.active = (1u << RAY_PACKET) - 1;
+                for (int k = 0; k < RAY_PACKET; k++) {
+                    const vec3f o = origin(x + (k & 1), y + (k >> 1));
+                    p.ox[k]   = o.x;
+                    p.oy[k]   = o.y;
+                    p.oz[k]   = o.z;
+                    p.tmax[k] = 1e30f;
+                }
+                const unsigned blocked = bvh.occluded(p);
+                for (int k = 0; k < RAY_PACKET; k++)
+                    packed[x + (k & 1) + (y + (k >> 1)) * size] = blocked >> k & 1;
+            }
+    });
+
+    size_t mismatches = 0, shadowed = 0;
+    for (size_t i = 0; i < single.size(); i++) {
+        mismatches += single[i] != packed[i];
+        shadowed += single[i];
+    }
+
+    std::printf("%8zu triangles  build %7.1f ms  single %6.2f  packet %6.2f Mrays/s  shadowed %4.1f%%  mismatches %zu\n",
+                triangles.size(), std::chrono::duration<double, std::milli>(end - start).count(), single_rate, packet_rate,
+                100. * static_cast<double>(shadowed) / static_cast<double>(single.size()), mismatches);
+}
+
+int main() {
+    run(4, 32);
+    run(16, 32);
+    run(32, 32);
+    return 0;
+}
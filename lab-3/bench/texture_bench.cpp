@@ -0,0 +1,109 @@
+// Bilinear sampling throughput of the tiled Texture2D layout against plain row-major storage,
+// along lines crossing the texture at random orientations.
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "texture.h"
+
+// The same Repeat bilinear filter over a row-major copy of level 0.
+struct RowMajorTexture {
+    int width;
+    int height;
+    std::vector<std::uint32_t> texels;
+
+    [[nodiscard]] vec4f texel(const size_t index) const {
+        const std::uint32_t t = texels[index];
+        constexpr float scale = 1.f / 255.f;
+        return {static_cast<float>(t & 0xffu) * scale, static_cast<float>(t >> 8 & 0xffu) * scale,
+                static_cast<float>(t >> 16 & 0xffu) * scale, static_cast<float>(t >> 24) * scale};
+    }
+
+    [[nodiscard]] vec4f sample(const vec2f &uv) const {
+        auto wrap = [](const int c, const int size) { return c < 0 ? c + size : c >= size ? c - size : c; };
+        const float fx = (uv.x - std::floor(uv.x)) * static_cast<float>(width) - .5f;
+        const float fy = (uv.y - std::floor(uv.y)) * static_cast<float>(height) - .5f;
+        const float bx = std::floor(fx), by = std::floor(fy);
+        const float tx = fx - bx, ty = fy - by;
+        const int x0 = wrap(static_cast<int>(bx), width), x1 = wrap(x0 + 1, width);
+        const int y0 = wrap(static_cast<int>(by), height), y1 = wrap(y0 + 1, height);
+
+        const size_t r0 = static_cast<size_t>(y0) * width, r1 = static_cast<size_t>(y1) * width;
+        const vec4f top    = texel(r0 + x0) * (1.f - tx) + texel(r0 + x1) * tx;
+        const vec4f bottom = texel(r1 + x0) * (1.f - tx) + texel(r1 + x1) * tx;
+        return top * (1.f - ty) + bottom * ty;
+    }
+};
+
+// Walks of one texel per step, starting anywhere and heading in any direction
+static std::vector<vec2f> random_walks(const int size, const int walks, const int steps) {
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> unit(0.f, 1.f);
+    std::vector<vec2f> uvs;
+    uvs.reserve(static_cast<size_t>(walks) * steps);
+    for (int w = 0; w < walks; w++) {
+        const vec2f start = {unit(rng), unit(rng)};
+        const float angle = unit(rng) * 6.2831853f;
+        const vec2f step  = vec2f{std::cos(angle), std::sin(angle)} * (1.f / static_cast<float>(size));
+        for (int s = 0; s < steps; s++)
+            uvs.push_back(start + step * static_cast<float>(s));
+    }
+    return uvs;
+}
+
+template <typename F>
+static double msamples_per_s(const size_t count, F &&f) {
+    const auto start = std::chrono::steady_clock::now();
+    f();
+    const auto end = std::chrono::steady_clock::now();
+    return static_cast<double>(count) / std::chrono::duration<double, std::micro>(end - start).count();
+}
+
+static void run(const int size) {
+    std::mt19937 rng(7);
+    TGAImage image(size, size, TGAImage::RGBA);
+    for (int y = 0; y < size; y++)
+        for (int x = 0; x < size; x++) {
+            const std::uint32_t v = rng();
+            image.set(x, y, {{static_cast<std::uint8_t>(v), static_cast<std::uint8_t>(v >> 8),
+                              static_cast<std::uint8_t>(v >> 16), static_cast<std::uint8_t>(v >> 24)}, 4});
+        }
+
+    const Texture2D tiled(image, false);
+    RowMajorTexture row_major{size, size, std::vector<std::uint32_t>(static_cast<size_t>(size) * size)};
+    for (int y = 0; y < size; y++)
+        for (int x = 0; x < size; x++) {
+            const vec4f c = tiled.fetch(0, x, y);
+            row_major.texels[x + y * size] = static_cast<std::uint32_t>(std::lround(c.x * 255.f)) |
+                                             static_cast<std::uint32_t>(std::lround(c.y * 255.f)) << 8 |
+                                             static_cast<std::uint32_t>(std::lround(c.z * 255.f)) << 16 |
+                                             static_cast<std::uint32_t>(std::lround(c.w * 255.f)) << 24;
+        }
+
+    const std::vector<vec2f> uvs = random_walks(size, 1 << 14, 256);
+    const Sampler bilinear{TextureFilter::Bilinear, TextureWrap::Repeat};
+    volatile float sink = 0;
+
+    const double ref = msamples_per_s(uvs.size(), [&] { for (const vec2f &uv: uvs) sink = sink + row_major.sample(uv).x; });
+    const double new_ = msamples_per_s(uvs.size(), [&] { for (const vec2f &uv: uvs) sink = sink + tiled.sample(bilinear, uv).x; });
+
+    float max_err = 0;
+    for (size_t i = 0; i < uvs.size(); i += 97) {
+        const vec4f a = row_major.sample(uvs[i]), b = tiled.sample(bilinear, uvs[i]);
+        for (int c = 0; c < 4; c++)
+            max_err = std::max(max_err, std::abs(a[c] - b[c]));
+    }
+
+    std::printf("%5dx%-5d  row-major %6.1f  tiled %6.1f Msamples/s  max |diff| %.2e\n", size, size, ref, new_, max_err);
+}
+
+int main() {
+    run(512);
+    run(2048);
+    run(4096);
+    return 0;
+}
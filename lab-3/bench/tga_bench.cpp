@@ -0,0 +1,59 @@
+// TGA write/read round trip, with and without RLE, over patterns that stress the RLE encoder:
+// flat runs, noise, and single raw pixels alternating with runs of two (one header per pixel).
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+
+#include "tgaimage.h"
+
+static TGAImage make_image(const int size, const int bpp, const int pattern) {
+    TGAImage image(size, size, bpp);
+    std::mt19937 rng(7);
+    for (int y = 0; y < size; y++)
+        for (int x = 0; x < size; x++) {
+            TGAColor c;
+            for (int b = 0; b < bpp; b++)
+                switch (pattern) {
+                    case 0:  c[b] = static_cast<std::uint8_t>(40 * b + (x / 37 + y / 23) % 5); break;
+                    case 1:  c[b] = static_cast<std::uint8_t>(rng()); break;
+                    default: c[b] = static_cast<std::uint8_t>((x % 3 == 0 ? 0 : 255) - b); break;
+                }
+            image.set(x, y, c);
+        }
+    return image;
+}
+
+int main() {
+    constexpr int size = 300;
+    const char *pattern_names[] = {"runs", "noise", "alternating"};
+    const std::string path = "tga_bench.tga";
+
+    for (const int bpp: {TGAImage::GRAYSCALE, TGAImage::RGB, TGAImage::RGBA})
+        for (int pattern = 0; pattern < 3; pattern++)
+            for (const bool rle: {false, true}) {
+                const TGAImage image = make_image(size, bpp, pattern);
+                const auto t0 = std::chrono::steady_clock::now();
+                image.write_tga_file(path, false, rle);
+                const auto t1 = std::chrono::steady_clock::now();
+                TGAImage loaded;
+                const bool ok = loaded.read_tga_file(path) && loaded.width() == size && loaded.height() == size &&
+                                loaded.bytespp() == bpp;
+                const auto t2 = std::chrono::steady_clock::now();
+
+                size_t mismatches = ok ? 0 : static_cast<size_t>(size) * size;
+                for (int y = 0; ok && y < size; y++)
+                    for (int x = 0; x < size; x++) {
+                        const TGAColor a = image.get(x, y), b = loaded.get(x, y);
+                        for (int c = 0; c < bpp; c++)
+                            mismatches += a[c] != b[c];
+                    }
+
+                const auto ms = [](const auto d) { return std::chrono::duration<double, std::milli>(d).count(); };
+                std::printf("bpp %d  %-11s  %-3s  write %6.2f ms  read %6.2f ms  mismatches %zu\n", bpp,
+                            pattern_names[pattern], rle ? "rle" : "raw", ms(t1 - t0), ms(t2 - t1), mismatches);
+            }
+    std::remove(path.c_str());
+    return 0;
+}
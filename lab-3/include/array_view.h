@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// Read-only view of a contiguous array owned elsewhere (a std::vector or a mapped file).
+template<typename T>
+class ArrayView {
+public:
+    ArrayView() = default;
+    ArrayView(const T *data, const size_t size) : data_(data), size_(size) {}
+    ArrayView(const std::vector<T> &v) : data_(v.data()), size_(v.size()) {}
+
+    [[nodiscard]] const T *data() const { return data_; }
+    [[nodiscard]] size_t size() const { return size_; }
+    [[nodiscard]] bool empty() const { return size_ == 0; }
+
+    [[nodiscard]] const T &operator[](const size_t i) const { return data_[i]; }
+    [[nodiscard]] const T *begin() const { return data_; }
+    [[nodiscard]] const T *end() const { return data_ + size_; }
+
+private:
+    const T *data_ = nullptr;
+    size_t   size_ = 0;
+};
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <vector>
+
+#include "culling.h"
+#include "math/vec.h"
+
+// A triangle as the BVH stores it: one corner and the two edges leaving it.
+struct BvhTriangle {
+    vec3f v0;
+    vec3f e1;
+    vec3f e2;
+};
+
+// 32 bytes, in depth-first order: an inner node's first child follows it and `index` is its second
+// child; a leaf holds the triangles [index, index + count).
+struct BvhNode {
+    vec3f min;
+    int   index;
+    vec3f max;
+    int   count; // 0 for inner nodes
+};
+
+constexpr int RAY_PACKET = 4;
+
+// Rays sharing one direction, such as the shadow rays of a 2x2 pixel quad towards a directional
+// light. Origins are stored per component so each test runs over all lanes at once.
+struct RayPacket {
+    float    ox[RAY_PACKET];
+    float    oy[RAY_PACKET];
+    float    oz[RAY_PACKET];
+    float    tmax[RAY_PACKET];
+    vec3f    dir;
+    float    tmin   = 0;
+    unsigned active = 0; // lanes carrying a ray
+};
+
+// Bounding volume hierarchy over a static triangle soup, for occlusion queries. Built with the
+// binned surface area heuristic; the upper levels are split serially and the subtrees below them
+// are built in parallel.
+class Bvh {
+public:
+    Bvh() = default;
+    explicit Bvh(const std::vector<BvhTriangle> &triangles);
+
+    [[nodiscard]] bool empty() const { return nodes_.empty(); }
+    [[nodiscard]] size_t nnodes() const { return nodes_.size(); }
+    [[nodiscard]] size_t ntriangles() const { return triangles_.size(); }
+    [[nodiscard]] Aabb bounds() const;
+
+    // True if any triangle crosses origin + t * dir for t in (tmin, tmax).
+    [[nodiscard]] bool occluded(const vec3f &origin, const vec3f &dir, float tmin, float tmax) const;
+
+    // Mask of the active lanes whose ray is blocked. Nodes are visited once for the whole packet.
+    [[nodiscard]] unsigned occluded(const RayPacket &packet) const;
+
+private:
+    std::vector<BvhNode>     nodes_;
+    std::vector<BvhTriangle> triangles_;
+};
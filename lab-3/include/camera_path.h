@@ -0,0 +1,21 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "math/vec.h"
+
+// One camera pose of a batch render: the Scene's eye, center and up.
+struct CameraKeyframe {
+    vec3 eye;
+    vec3 center;
+    vec3 up;
+};
+
+// Reads keyframes from a text file, one per line as nine numbers: eye, center and up. Blank lines
+// and lines starting with '#' are skipped. Returns false if the file can't be read, a line is
+// malformed or there are no keyframes.
+bool load_camera_path(const std::string &filename, std::vector<CameraKeyframe> &path);
+
+// Pose at t in [0, 1] along the path, linear between evenly spaced keyframes.
+CameraKeyframe camera_path_at(const std::vector<CameraKeyframe> &path, double t);
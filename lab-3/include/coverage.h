@@ -0,0 +1,41 @@
+#pragma once
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+#include "math/vec.h"
+
+// Number of horizontally adjacent pixels evaluated per coverage/early-Z kernel call.
+constexpr int COVERAGE_LANES = 4;
+
+// Lane k of a span holds base + offset[k]. Every dispatch target performs exactly the same
+// additions, so all of them produce bit-identical masks.
+struct CoverageSetup {
+    vec_soa<3, COVERAGE_LANES, double> bc_offset;
+    double z_offset[COVERAGE_LANES];
+    double bc_eps[3];
+};
+
+struct CoverageMask {
+    unsigned pass;    // inside the triangle and closer than the depth buffer
+    unsigned recheck; // too close to an edge to decide from stepped barycentrics
+};
+
+// Tests `count` (1..COVERAGE_LANES) pixels whose first barycentrics/depth are bc/z against zbuf[0..count).
+using CoverageKernel = CoverageMask (*)(const CoverageSetup &setup, const vec3 &bc, double z, const double *zbuf, int count);
+
+// Widest kernel supported by the running CPU (AVX2, SSE2 or scalar), selected once.
+CoverageKernel coverage_kernel();
+const char *coverage_kernel_name();
+
+// Index of the lowest set lane of a non-empty mask.
+inline int lowest_lane(const unsigned mask) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctz(mask);
+#endif
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <algorithm>
+#include <limits>
+
+#include "math/mat.h"
+#include "math/vec.h"
+
+struct Aabb {
+    vec3f min{std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max()};
+    vec3f max{-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max()};
+
+    void expand(const vec3f &p) {
+        for (int i = 0; i < 3; i++) {
+            min[i] = std::min(min[i], p[i]);
+            max[i] = std::max(max[i], p[i]);
+        }
+    }
+
+    [[nodiscard]] bool empty() const { return min.x > max.x; }
+};
+
+struct BoundingSphere {
+    vec3f center;
+    float radius = 0;
+};
+
+// Both volumes of the same geometry: the sphere is the cheaper test, the box the tighter one.
+struct Bounds {
+    Aabb           box;
+    BoundingSphere sphere;
+};
+
+// A run of consecutive faces of one submesh, culled as a unit: by its bounds against the view, and
+// by its normal cone once every face has turned away from the eye. Stored in the .trmesh cache.
+struct Meshlet {
+    int    first_face;
+    int    nfaces;
+    Bounds bounds;
+    vec3f  cone_axis;       // mean face normal
+    float  cone_cutoff = 1; // sine of the widest angle between a face normal and the axis; 1: no cone
+};
+
+// The part of object space that lands in the viewport, as half-spaces of clip_from_object:
+// w above near_w and x/y inside the ndc window [ndc_min, ndc_max]. There is no far plane.
+class Frustum {
+public:
+    Frustum(const mat4 &clip_from_object, const vec2 &ndc_min, const vec2 &ndc_max, double near_w);
+
+    // True only if the volume lies entirely outside one of the planes.
+    [[nodiscard]] bool culled(const BoundingSphere &sphere) const;
+    [[nodiscard]] bool culled(const Aabb &box) const;
+    [[nodiscard]] bool culled(const Bounds &bounds) const { return culled(bounds.sphere) || culled(bounds.box); }
+
+    // True only if every face of the meshlet faces away from the eye, wherever it is in its sphere.
+    [[nodiscard]] bool backfacing(const Meshlet &meshlet) const;
+
+private:
+    vec4 planes_[5]; // inside where planes_[i] * {x, y, z, 1} >= 0
+    vec3 eye_;       // where clip x, y and w all vanish
+    bool has_eye_ = false;
+};
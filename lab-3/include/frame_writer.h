@@ -0,0 +1,53 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "hdr_image.h"
+#include "tgaimage.h"
+
+// Encodes and writes finished frames on background threads while the caller renders the next
+// ones. Frame buffers are recycled: submit() swaps the caller's image with one the writers are
+// done with, so a frame costs no allocation and no copy once the pipeline is primed.
+class FrameWriter {
+public:
+    // At most `queue_depth` frames are pending or being written; submit() blocks beyond that.
+    FrameWriter(int threads, int queue_depth);
+    ~FrameWriter();
+
+    FrameWriter(const FrameWriter &) = delete;
+    FrameWriter &operator=(const FrameWriter &) = delete;
+
+    // Queues the frame for write_image() and leaves stale contents of the same size in `ldr` (and
+    // `hdr`, when given) to be cleared for the next frame.
+    void submit(const std::string &filename, TGAImage &ldr, HdrImage *hdr);
+
+    // Waits until every submitted frame is written; false if any write failed.
+    bool finish();
+
+private:
+    struct Frame {
+        std::string filename;
+        TGAImage    ldr;
+        HdrImage    hdr;
+        bool        has_hdr = false;
+    };
+
+    void work();
+
+    int queue_depth_;
+    int in_flight_ = 0;
+    bool stopping_ = false;
+    bool failed_   = false;
+
+    std::mutex              mutex_;
+    std::condition_variable pending_ready_;
+    std::condition_variable frame_done_;
+    std::deque<Frame>       pending_;
+    std::vector<Frame>      free_;
+    std::vector<std::thread> threads_;
+};
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <vector>
+
+#include "hdr_image.h"
+#include "tgaimage.h"
+#include "math/vec.h"
+
+struct IShader;
+
+// What is visible at a pixel: the draw, its face and the perspective-correct barycentrics there,
+// with their screen-space derivatives for texture filtering. Attributes (uv, normal, tangent
+// frame, material) are fetched from the draw's shader by index, so a texel stays 44 bytes
+// regardless of what the shader interpolates.
+struct GBufferTexel {
+    vec3f bar;
+    vec3f bar_dx;
+    vec3f bar_dy;
+    int   face = -1;
+    int   draw = -1; // -1: background, or shaded by the forward path
+};
+
+// Deferred shading target. The rasterizer only resolves visibility into it; resolve() then runs
+// every draw's fragment() exactly once per visible pixel, independent of depth complexity.
+// Shaders registered with add_draw() must stay alive until resolve().
+class GBuffer {
+public:
+    GBuffer(int width, int height);
+
+    void clear();
+
+    // Id recorded in the texels covered by the next draw of `shader`.
+    int add_draw(const IShader &shader);
+
+    [[nodiscard]] int width() const { return width_; }
+    [[nodiscard]] int height() const { return height_; }
+    [[nodiscard]] GBufferTexel *row(const int y) { return &texels_[y * width_]; }
+    [[nodiscard]] const GBufferTexel &at(const int x, const int y) const { return texels_[x + y * width_]; }
+
+    // Lighting pass: writes the shaded color of every texel that holds a draw into the framebuffer.
+    void resolve(TGAImage &framebuffer) const;
+    void resolve(HdrImage &framebuffer) const;
+
+private:
+    template<class Target>
+    void resolve_into(Target &framebuffer) const;
+
+    int width_;
+    int height_;
+
+    std::vector<GBufferTexel>   texels_;
+    std::vector<const IShader*> draws_;
+};
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "tgaimage.h"
+#include "math/vec.h"
+
+// Linear float RGB image; rows run bottom-up like the framebuffer. 1 is the brightest value an
+// 8-bit target can show, and shading above it is kept until the image is tonemapped.
+class HdrImage {
+public:
+    HdrImage() = default;
+    HdrImage(int width, int height, const vec3f &clear = {});
+
+    [[nodiscard]] int width() const { return width_; }
+    [[nodiscard]] int height() const { return height_; }
+    [[nodiscard]] bool empty() const { return pixels_.empty(); }
+
+    [[nodiscard]] const vec3f &get(const int x, const int y) const { return pixels_[x + y * width_]; }
+    void set(const int x, const int y, const vec3f &c) { pixels_[x + y * width_] = c; }
+
+    [[nodiscard]] const vec3f *row(const int y) const { return &pixels_[y * width_]; }
+
+    void clear(const vec3f &c) { std::fill(pixels_.begin(), pixels_.end(), c); }
+
+private:
+    int width_  = 0;
+    int height_ = 0;
+    std::vector<vec3f> pixels_;
+};
+
+enum class Tonemap {
+    Clamp,    // saturate at 1, as an 8-bit framebuffer does
+    Reinhard, // c / (1 + c)
+    Aces      // Narkowicz's fit of the ACES filmic curve
+};
+
+inline std::uint8_t quantize_unorm8(const float v) {
+    return static_cast<std::uint8_t>(std::clamp(static_cast<int>(v * 255.f), 0, 255));
+}
+
+inline vec3f from_unorm8(const TGAColor &c) {
+    return {c[2] / 255.f, c[1] / 255.f, c[0] / 255.f};
+}
+
+// Exposes, tonemaps and quantizes the whole image into an 8-bit RGB target of the same size,
+// once per pixel and in parallel over rows. `exposure` is in stops.
+void tonemap(const HdrImage &src, TGAImage &dst, Tonemap op = Tonemap::Clamp, float exposure = 0.f);
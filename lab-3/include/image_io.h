@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+
+#include "hdr_image.h"
+#include "tgaimage.h"
+
+// Uncompressed frame writers for pipelines that hand frames straight to a compositor. Each file
+// is assembled in memory and written with a single call.
+
+// Binary PPM (P6), 8-bit RGB, top row first.
+bool write_ppm(const std::string &filename, const TGAImage &image);
+
+// PFM, 32-bit float RGB, little endian, bottom row first as the format specifies.
+bool write_pfm(const std::string &filename, const HdrImage &image);
+
+// Headerless pixels, top row first: 8-bit RGB, or 32-bit float RGB.
+bool write_raw(const std::string &filename, const TGAImage &image);
+bool write_raw(const std::string &filename, const HdrImage &image);
+
+// True if `s` ends with `suffix`, e.g. an output name with its extension.
+bool ends_with(const std::string &s, const std::string &suffix);
+
+// Picks the writer from the extension: .ppm, .pfm, .raw, anything else is TGA. .pfm needs `hdr`;
+// .raw writes floats when given `hdr`, else bytes.
+bool write_image(const std::string &filename, const TGAImage &ldr, const HdrImage *hdr);
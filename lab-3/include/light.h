@@ -0,0 +1,56 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "culling.h"
+#include "math/vec.h"
+
+// Point light, or spot light when cos_outer > -1. Its light ends at `radius`.
+struct Light {
+    vec3  position;
+    vec3f color{1, 1, 1};
+    float radius    = 1;
+    vec3  direction{0, -1, 0}; // spot axis
+    float cos_outer = -1;      // spot cone: full intensity inside cos_inner, none outside cos_outer
+    float cos_inner = -1;
+};
+
+// A light moved to view space, as the shaders read it.
+struct ViewLight {
+    vec3f position;
+    float radius;
+    vec3f color;
+    float cos_outer;
+    vec3f direction;
+    float cos_inner;
+};
+
+// Deterministic test lights spread over a world-space box, a spot light in every four. Radii shrink
+// with the count so a point of the box is reached by a similar number of lights for any count.
+std::vector<Light> scatter_lights(int count, const Aabb &box);
+
+// Adds the Phong response to one light of a view-space point `pos` with unit normal `n`, seen along
+// +z as PhongShader does. Inverse square falloff, softened within a unit distance and windowed to
+// reach zero at the radius.
+inline void accumulate_light(const ViewLight &light, const vec3f &pos, const vec3f &n, vec3f &diffuse, vec3f &specular) {
+    const vec3f to_light = light.position - pos;
+    const float d2 = to_light * to_light, r2 = light.radius * light.radius;
+    if (d2 >= r2) return;
+
+    const vec3f l     = to_light / std::sqrt(d2);
+    const float ndotl = n * l;
+    if (ndotl <= 0) return;
+
+    const float window = 1.f - d2 * d2 / (r2 * r2);
+    float attenuation  = window * window / (1.f + d2);
+    if (light.cos_outer > -1.f) {
+        const float t = std::clamp((-(l * light.direction) - light.cos_outer) / std::max(light.cos_inner - light.cos_outer, 1e-4f), 0.f, 1.f);
+        attenuation *= t * t * (3.f - 2.f * t);
+    }
+
+    const vec3f r = n * (ndotl * 2.f) - l;
+    diffuse  = diffuse + light.color * (attenuation * ndotl);
+    specular = specular + light.color * (attenuation * std::pow(std::max(r.z, 0.f), 35.f));
+}
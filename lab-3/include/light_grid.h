@@ -0,0 +1,51 @@
+#pragma once
+
+#include <vector>
+
+#include "array_view.h"
+#include "camera.h"
+#include "light.h"
+#include "our_gl.h"
+
+// Per screen tile, the lights that can reach the geometry in it (tiled light culling). Each light
+// is bounded by the box around its sphere, projected to a screen rectangle and a depth range.
+// With a depth buffer, a tile keeps the lights whose range overlaps the depths in it, and tiles
+// without geometry get none.
+class LightGrid {
+public:
+    static constexpr int TILE_SIZE = 16;
+
+    LightGrid(int width, int height);
+
+    // `depth` may be nullptr (forward shading, before the frame is drawn): tiles then keep every
+    // light over them.
+    void build(ArrayView<Light> lights, const Camera &camera, const DepthBuffer *depth);
+
+    // Indices of the lights to shade pixel (x, y) with, in increasing order
+    [[nodiscard]] ArrayView<int> lights_at(const int x, const int y) const {
+        return tiles_[x / TILE_SIZE + y / TILE_SIZE * tiles_x_];
+    }
+    [[nodiscard]] const ViewLight &light(const int i) const { return view_lights_[i]; }
+
+    [[nodiscard]] size_t nlights() const { return view_lights_.size(); }
+    [[nodiscard]] size_t ntiles() const { return tiles_.size(); }
+    // Light-tile pairs of the last build
+    [[nodiscard]] long long entries() const;
+
+private:
+    struct Extent {
+        int    x0, y0, x1, y1; // tiles
+        double zmin, zmax;     // depth buffer values, larger is nearer
+    };
+
+    int width_;
+    int height_;
+    int tiles_x_;
+    int tiles_y_;
+
+    std::vector<ViewLight>        view_lights_;
+    std::vector<Extent>           extents_;
+    std::vector<double>           tile_zmin_;
+    std::vector<double>           tile_zmax_;
+    std::vector<std::vector<int>> tiles_;
+};
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Read-only memory mapping of a whole file, released with the object.
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    bool open(const std::string &path);
+    void close();
+
+    [[nodiscard]] const std::byte *data() const { return data_; }
+    [[nodiscard]] size_t size() const { return size_; }
+
+private:
+    const std::byte *data_ = nullptr;
+    size_t           size_ = 0;
+#ifdef _WIN32
+    void *file_    = nullptr;
+    void *mapping_ = nullptr;
+#endif
+};
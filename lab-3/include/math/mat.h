@@ -7,50 +7,53 @@
 
 #include "math/vec.h"
 
-template <int N>
+template <int N, typename T = double>
 struct dt;
 
-template <int R, int C>
+template <int N, typename T = double>
+struct inv;
+
+template <int R, int C, typename T = double>
 struct mat {
-    vec<C> rows[R] = {};
+    vec<C, T> rows[R] = {};
 
     mat() = default;
 
-    mat(std::initializer_list<vec<C>> init) {
+    mat(std::initializer_list<vec<C, T>> init) {
         assert(static_cast<int>(init.size()) == R);
         std::copy(init.begin(), init.end(), rows);
     }
 
-    mat(std::initializer_list<std::initializer_list<double>> init) {
+    mat(std::initializer_list<std::initializer_list<T>> init) {
         assert(static_cast<int>(init.size()) == R);
         int r = 0;
         for (const auto &row_init : init) {
             assert(static_cast<int>(row_init.size()) == C);
             int c = 0;
-            for (double v : row_init) {
+            for (T v : row_init) {
                 rows[r][c++] = v;
             }
             ++r;
         }
     }
 
-    vec<C> &operator[](int idx) {
+    constexpr vec<C, T> &operator[](int idx) {
         assert(idx >= 0 && idx < R);
         return rows[idx];
     }
 
-    const vec<C> &operator[](int idx) const {
+    constexpr const vec<C, T> &operator[](int idx) const {
         assert(idx >= 0 && idx < R);
         return rows[idx];
     }
 
-    double det() const {
+    constexpr T det() const {
         static_assert(R == C, "determinant requires square matrix");
-        return dt<C>::det(*this);
+        return dt<C, T>::det(*this);
     }
 
-    double cofactor(int row, int col) const {
-        mat<R - 1, C - 1> submatrix;
+    T cofactor(int row, int col) const {
+        mat<R - 1, C - 1, T> submatrix;
         for (int i = 0, si = 0; i < R; ++i) {
             if (i == row) continue;
             for (int j = 0, sj = 0; j < C; ++j) {
@@ -60,26 +63,36 @@ struct mat {
             }
             ++si;
         }
-        const double sign = ((row + col) % 2 == 0) ? 1.0 : -1.0;
+        const T sign = ((row + col) % 2 == 0) ? T(1) : T(-1);
         return sign * submatrix.det();
     }
 
-    mat invert_transpose() const {
-        mat adjugate_transpose;
-        for (int i = 0; i < R; ++i) {
-            for (int j = 0; j < C; ++j) {
-                adjugate_transpose[i][j] = cofactor(i, j);
+    constexpr mat invert_transpose() const {
+        static_assert(R == C, "inverse requires square matrix");
+        if constexpr (R >= 2 && R <= 4) {
+            return inv<R, T>::invert_transpose(*this);
+        } else {
+            mat adjugate_transpose;
+            for (int i = 0; i < R; ++i) {
+                for (int j = 0; j < C; ++j) {
+                    adjugate_transpose[i][j] = cofactor(i, j);
+                }
             }
+            return adjugate_transpose / (adjugate_transpose[0] * rows[0]);
         }
-        return adjugate_transpose / (adjugate_transpose[0] * rows[0]);
     }
 
-    mat invert() const {
-        return invert_transpose().transpose();
+    constexpr mat invert() const {
+        static_assert(R == C, "inverse requires square matrix");
+        if constexpr (R >= 2 && R <= 4) {
+            return inv<R, T>::invert(*this);
+        } else {
+            return invert_transpose().transpose();
+        }
     }
 
-    mat<C, R> transpose() const {
-        mat<C, R> ret;
+    mat<C, R, T> transpose() const {
+        mat<C, R, T> ret;
         for (int i = 0; i < C; ++i) {
             for (int j = 0; j < R; ++j) {
                 ret[i][j] = rows[j][i];
@@ -89,23 +102,23 @@ struct mat {
     }
 };
 
-template <int R, int C>
- vec<C> operator*(const vec<R> &lhs, const mat<R, C> &rhs) {
-    return (mat<1, R>{{lhs}} * rhs)[0];
+template <int R, int C, typename T>
+ vec<C, T> operator*(const vec<R, T> &lhs, const mat<R, C, T> &rhs) {
+    return (mat<1, R, T>{{lhs}} * rhs)[0];
 }
 
-template <int R, int C>
- vec<R> operator*(const mat<R, C> &lhs, const vec<C> &rhs) {
-    vec<R> ret;
+template <int R, int C, typename T>
+ vec<R, T> operator*(const mat<R, C, T> &lhs, const vec<C, T> &rhs) {
+    vec<R, T> ret;
     for (int i = 0; i < R; ++i) {
         ret[i] = lhs[i] * rhs;
     }
     return ret;
 }
 
-template <int R1, int C1, int C2>
- mat<R1, C2> operator*(const mat<R1, C1> &lhs, const mat<C1, C2> &rhs) {
-    mat<R1, C2> result;
+template <int R1, int C1, int C2, typename T>
+ mat<R1, C2, T> operator*(const mat<R1, C1, T> &lhs, const mat<C1, C2, T> &rhs) {
+    mat<R1, C2, T> result;
     for (int i = 0; i < R1; ++i)
         for (int j = 0; j < C2; ++j)
             for (int k = 0; k < C1; ++k)
@@ -113,27 +126,27 @@ template <int R1, int C1, int C2>
     return result;
 }
 
-template <int R, int C>
- mat<R, C> operator*(const mat<R, C> &lhs, double val) {
-    mat<R, C> result;
+template <int R, int C, typename T>
+ mat<R, C, T> operator*(const mat<R, C, T> &lhs, typename vec<C, T>::scalar val) {
+    mat<R, C, T> result;
     for (int i = 0; i < R; ++i) {
         result[i] = lhs[i] * val;
     }
     return result;
 }
 
-template <int R, int C>
- mat<R, C> operator/(const mat<R, C> &lhs, double val) {
-    mat<R, C> result;
+template <int R, int C, typename T>
+ mat<R, C, T> operator/(const mat<R, C, T> &lhs, typename vec<C, T>::scalar val) {
+    mat<R, C, T> result;
     for (int i = 0; i < R; ++i) {
         result[i] = lhs[i] / val;
     }
     return result;
 }
 
-template <int R, int C>
- mat<R, C> operator+(const mat<R, C> &lhs, const mat<R, C> &rhs) {
-    mat<R, C> result;
+template <int R, int C, typename T>
+ mat<R, C, T> operator+(const mat<R, C, T> &lhs, const mat<R, C, T> &rhs) {
+    mat<R, C, T> result;
     for (int i = 0; i < R; ++i) {
         for (int j = 0; j < C; ++j) {
             result[i][j] = lhs[i][j] + rhs[i][j];
@@ -142,9 +155,9 @@ template <int R, int C>
     return result;
 }
 
-template <int R, int C>
- mat<R, C> operator-(const mat<R, C> &lhs, const mat<R, C> &rhs) {
-    mat<R, C> result;
+template <int R, int C, typename T>
+ mat<R, C, T> operator-(const mat<R, C, T> &lhs, const mat<R, C, T> &rhs) {
+    mat<R, C, T> result;
     for (int i = 0; i < R; ++i) {
         for (int j = 0; j < C; ++j) {
             result[i][j] = lhs[i][j] - rhs[i][j];
@@ -153,18 +166,18 @@ template <int R, int C>
     return result;
 }
 
-template <int R, int C>
- std::ostream &operator<<(std::ostream &out, const mat<R, C> &m) {
+template <int R, int C, typename T>
+ std::ostream &operator<<(std::ostream &out, const mat<R, C, T> &m) {
     for (int i = 0; i < R; ++i) {
         out << m[i] << std::endl;
     }
     return out;
 }
 
-template <int N>
+template <int N, typename T>
 struct dt {
-    static double det(const mat<N, N> &src) {
-        double ret = 0;
+    static T det(const mat<N, N, T> &src) {
+        T ret = 0;
         for (int i = 0; i < N; ++i) {
             ret += src[0][i] * src.cofactor(0, i);
         }
@@ -172,13 +185,161 @@ struct dt {
     }
 };
 
-template <>
-struct dt<1> {
-    static double det(const mat<1, 1> &src) {
-        return src[0][0];
+template <typename T>
+struct dt<1, T> {
+    static constexpr T det(const mat<1, 1, T> &src) {
+        return src[0].data[0];
+    }
+};
+
+// Closed forms for the sizes the renderer uses; larger matrices fall back to cofactor expansion.
+// They only touch named components, so they can be evaluated at compile time.
+
+template <typename T>
+struct dt<2, T> {
+    static constexpr T det(const mat<2, 2, T> &m) {
+        return m[0].x * m[1].y - m[0].y * m[1].x;
+    }
+};
+
+template <typename T>
+struct dt<3, T> {
+    static constexpr T det(const mat<3, 3, T> &m) {
+        return m[0].x * (m[1].y * m[2].z - m[1].z * m[2].y)
+             - m[0].y * (m[1].x * m[2].z - m[1].z * m[2].x)
+             + m[0].z * (m[1].x * m[2].y - m[1].y * m[2].x);
+    }
+};
+
+// 2x2 minors of the top (s) and bottom (c) row pairs of a 4x4 matrix; both the determinant
+// and the adjugate are sums of their products.
+template <typename T>
+struct minors4 {
+    T s0, s1, s2, s3, s4, s5;
+    T c0, c1, c2, c3, c4, c5;
+
+    explicit constexpr minors4(const mat<4, 4, T> &m)
+        : s0(m[0].x * m[1].y - m[1].x * m[0].y), s1(m[0].x * m[1].z - m[1].x * m[0].z),
+          s2(m[0].x * m[1].w - m[1].x * m[0].w), s3(m[0].y * m[1].z - m[1].y * m[0].z),
+          s4(m[0].y * m[1].w - m[1].y * m[0].w), s5(m[0].z * m[1].w - m[1].z * m[0].w),
+          c0(m[2].x * m[3].y - m[3].x * m[2].y), c1(m[2].x * m[3].z - m[3].x * m[2].z),
+          c2(m[2].x * m[3].w - m[3].x * m[2].w), c3(m[2].y * m[3].z - m[3].y * m[2].z),
+          c4(m[2].y * m[3].w - m[3].y * m[2].w), c5(m[2].z * m[3].w - m[3].z * m[2].w) {}
+
+    [[nodiscard]] constexpr T det() const {
+        return s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0;
+    }
+};
+
+template <typename T>
+struct dt<4, T> {
+    static constexpr T det(const mat<4, 4, T> &m) {
+        return minors4<T>(m).det();
+    }
+};
+
+template <typename T>
+struct inv<2, T> {
+    static constexpr mat<2, 2, T> invert(const mat<2, 2, T> &m) {
+        const T r = T(1) / dt<2, T>::det(m);
+        mat<2, 2, T> ret;
+        ret[0] = { m[1].y * r, -m[0].y * r};
+        ret[1] = {-m[1].x * r,  m[0].x * r};
+        return ret;
+    }
+
+    static constexpr mat<2, 2, T> invert_transpose(const mat<2, 2, T> &m) {
+        const T r = T(1) / dt<2, T>::det(m);
+        mat<2, 2, T> ret;
+        ret[0] = { m[1].y * r, -m[1].x * r};
+        ret[1] = {-m[0].y * r,  m[0].x * r};
+        return ret;
+    }
+};
+
+template <typename T>
+struct inv<3, T> {
+    // Rows of the cofactor matrix are the cross products of the other two rows
+    static constexpr mat<3, 3, T> invert_transpose(const mat<3, 3, T> &m) {
+        const vec<3, T> &a = m[0], &b = m[1], &c = m[2];
+        const vec<3, T> bc = {b.y * c.z - b.z * c.y, b.z * c.x - b.x * c.z, b.x * c.y - b.y * c.x};
+        const vec<3, T> ca = {c.y * a.z - c.z * a.y, c.z * a.x - c.x * a.z, c.x * a.y - c.y * a.x};
+        const vec<3, T> ab = {a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x};
+        const T r = T(1) / (a.x * bc.x + a.y * bc.y + a.z * bc.z);
+        mat<3, 3, T> ret;
+        ret[0] = {bc.x * r, bc.y * r, bc.z * r};
+        ret[1] = {ca.x * r, ca.y * r, ca.z * r};
+        ret[2] = {ab.x * r, ab.y * r, ab.z * r};
+        return ret;
+    }
+
+    static constexpr mat<3, 3, T> invert(const mat<3, 3, T> &m) {
+        const mat<3, 3, T> it = invert_transpose(m);
+        mat<3, 3, T> ret;
+        ret[0] = {it[0].x, it[1].x, it[2].x};
+        ret[1] = {it[0].y, it[1].y, it[2].y};
+        ret[2] = {it[0].z, it[1].z, it[2].z};
+        return ret;
     }
 };
 
+template <typename T>
+struct inv<4, T> {
+    static constexpr mat<4, 4, T> invert(const mat<4, 4, T> &m) {
+        const minors4<T> k(m);
+        const T r = T(1) / k.det();
+        mat<4, 4, T> ret;
+        ret[0] = {( m[1].y * k.c5 - m[1].z * k.c4 + m[1].w * k.c3) * r,
+                  (-m[0].y * k.c5 + m[0].z * k.c4 - m[0].w * k.c3) * r,
+                  ( m[3].y * k.s5 - m[3].z * k.s4 + m[3].w * k.s3) * r,
+                  (-m[2].y * k.s5 + m[2].z * k.s4 - m[2].w * k.s3) * r};
+        ret[1] = {(-m[1].x * k.c5 + m[1].z * k.c2 - m[1].w * k.c1) * r,
+                  ( m[0].x * k.c5 - m[0].z * k.c2 + m[0].w * k.c1) * r,
+                  (-m[3].x * k.s5 + m[3].z * k.s2 - m[3].w * k.s1) * r,
+                  ( m[2].x * k.s5 - m[2].z * k.s2 + m[2].w * k.s1) * r};
+        ret[2] = {( m[1].x * k.c4 - m[1].y * k.c2 + m[1].w * k.c0) * r,
+                  (-m[0].x * k.c4 + m[0].y * k.c2 - m[0].w * k.c0) * r,
+                  ( m[3].x * k.s4 - m[3].y * k.s2 + m[3].w * k.s0) * r,
+                  (-m[2].x * k.s4 + m[2].y * k.s2 - m[2].w * k.s0) * r};
+        ret[3] = {(-m[1].x * k.c3 + m[1].y * k.c1 - m[1].z * k.c0) * r,
+                  ( m[0].x * k.c3 - m[0].y * k.c1 + m[0].z * k.c0) * r,
+                  (-m[3].x * k.s3 + m[3].y * k.s1 - m[3].z * k.s0) * r,
+                  ( m[2].x * k.s3 - m[2].y * k.s1 + m[2].z * k.s0) * r};
+        return ret;
+    }
+
+    static constexpr mat<4, 4, T> invert_transpose(const mat<4, 4, T> &m) {
+        const mat<4, 4, T> i = invert(m);
+        mat<4, 4, T> ret;
+        ret[0] = {i[0].x, i[1].x, i[2].x, i[3].x};
+        ret[1] = {i[0].y, i[1].y, i[2].y, i[3].y};
+        ret[2] = {i[0].z, i[1].z, i[2].z, i[3].z};
+        ret[3] = {i[0].w, i[1].w, i[2].w, i[3].w};
+        return ret;
+    }
+};
+
+// Inverse of a transform whose last row is {0, 0, 0, 1}: invert the 3x3 part and rotate the
+// negated translation by it. Cheaper than a general 4x4 inverse.
+template <typename T>
+constexpr mat<4, 4, T> affine_inverse(const mat<4, 4, T> &m) {
+    mat<3, 3, T> linear;
+    linear[0] = m[0].xyz();
+    linear[1] = m[1].xyz();
+    linear[2] = m[2].xyz();
+    const mat<3, 3, T> li = inv<3, T>::invert(linear);
+    mat<4, 4, T> ret;
+    ret[0] = {li[0].x, li[0].y, li[0].z, -(li[0].x * m[0].w + li[0].y * m[1].w + li[0].z * m[2].w)};
+    ret[1] = {li[1].x, li[1].y, li[1].z, -(li[1].x * m[0].w + li[1].y * m[1].w + li[1].z * m[2].w)};
+    ret[2] = {li[2].x, li[2].y, li[2].z, -(li[2].x * m[0].w + li[2].y * m[1].w + li[2].z * m[2].w)};
+    ret[3] = {0, 0, 0, 1};
+    return ret;
+}
+
 using mat2 = mat<2, 2>;
 using mat3 = mat<3, 3>;
 using mat4 = mat<4, 4>;
+
+using mat2f = mat<2, 2, float>;
+using mat3f = mat<3, 3, float>;
+using mat4f = mat<4, 4, float>;
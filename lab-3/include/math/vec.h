@@ -4,62 +4,70 @@
 #include <cmath>
 #include <iosfwd>
 
-template<int N>
+template<int N, typename T = double>
 struct vec {
-    double data[N]{};
+    using scalar = T;
 
-    double &operator[](int i) noexcept {
+    T data[N]{};
+
+    T &operator[](int i) noexcept {
         assert(i >= 0 && i < N);
         return data[i];
     }
 
-    double operator[](int i) const noexcept {
+    T operator[](int i) const noexcept {
         assert(i >= 0 && i < N);
         return data[i];
     }
 };
 
-template<>
-struct vec<2> {
-    double x = 0;
-    double y = 0;
+template<typename T>
+struct vec<2, T> {
+    using scalar = T;
+
+    T x = 0;
+    T y = 0;
 
-    double &operator[](int i) noexcept {
+    T &operator[](int i) noexcept {
         assert(i >= 0 && i < 2);
         return i == 0 ? x : y;
     }
 
-    double operator[](int i) const noexcept {
+    T operator[](int i) const noexcept {
         assert(i >= 0 && i < 2);
         return i == 0 ? x : y;
     }
 };
 
-template<>
-struct vec<3> {
-    double x = 0;
-    double y = 0;
-    double z = 0;
+template<typename T>
+struct vec<3, T> {
+    using scalar = T;
 
-    double &operator[](int i) noexcept {
+    T x = 0;
+    T y = 0;
+    T z = 0;
+
+    T &operator[](int i) noexcept {
         assert(i >= 0 && i < 3);
         return i == 0 ? x : (i == 1 ? y : z);
     }
 
-    double operator[](int i) const noexcept {
+    T operator[](int i) const noexcept {
         assert(i >= 0 && i < 3);
         return i == 0 ? x : (i == 1 ? y : z);
     }
 };
 
-template<>
-struct vec<4> {
-    double x = 0;
-    double y = 0;
-    double z = 0;
-    double w = 0;
+template<typename T>
+struct alignas(4 * sizeof(T) == 16 ? 16 : alignof(T)) vec<4, T> {
+    using scalar = T;
+
+    T x = 0;
+    T y = 0;
+    T z = 0;
+    T w = 0;
 
-    double &operator[](int i) noexcept {
+    T &operator[](int i) noexcept {
         assert(i >= 0 && i < 4);
         if (i == 0) return x;
         if (i == 1) return y;
@@ -67,7 +75,7 @@ struct vec<4> {
         return w;
     }
 
-    double operator[](int i) const noexcept {
+    T operator[](int i) const noexcept {
         assert(i >= 0 && i < 4);
         if (i == 0) return x;
         if (i == 1) return y;
@@ -75,82 +83,121 @@ struct vec<4> {
         return w;
     }
 
-    [[nodiscard]] vec<2> xy() const noexcept { return {x, y}; }
-    [[nodiscard]] vec<3> xyz() const noexcept { return {x, y, z}; }
+    [[nodiscard]] constexpr vec<2, T> xy() const noexcept { return {x, y}; }
+    [[nodiscard]] constexpr vec<3, T> xyz() const noexcept { return {x, y, z}; }
 };
 
 using vec2 = vec<2>;
 using vec3 = vec<3>;
 using vec4 = vec<4>;
 
-template<int N>
-double operator*(const vec<N> &lhs, const vec<N> &rhs) noexcept {
-    double ret = 0;
+using vec2f = vec<2, float>;
+using vec3f = vec<3, float>;
+using vec4f = vec<4, float>;
+
+static_assert(sizeof(vec3f) == 3 * sizeof(float) && sizeof(vec4f) == 16 && alignof(vec4f) == 16);
+
+template<int N, typename T>
+T operator*(const vec<N, T> &lhs, const vec<N, T> &rhs) noexcept {
+    T ret = 0;
     for (int i = 0; i < N; ++i) {
         ret += lhs[i] * rhs[i];
     }
     return ret;
 }
 
-template<int N>
-vec<N> operator+(const vec<N> &lhs, const vec<N> &rhs) noexcept {
-    vec<N> ret = lhs;
+template<int N, typename T>
+vec<N, T> operator+(const vec<N, T> &lhs, const vec<N, T> &rhs) noexcept {
+    vec<N, T> ret = lhs;
     for (int i = 0; i < N; ++i) {
         ret[i] += rhs[i];
     }
     return ret;
 }
 
-template<int N>
-vec<N> operator-(const vec<N> &lhs, const vec<N> &rhs) noexcept {
-    vec<N> ret = lhs;
+template<int N, typename T>
+vec<N, T> operator-(const vec<N, T> &lhs, const vec<N, T> &rhs) noexcept {
+    vec<N, T> ret = lhs;
     for (int i = 0; i < N; ++i) {
         ret[i] -= rhs[i];
     }
     return ret;
 }
 
-template<int N>
-vec<N> operator*(const vec<N> &lhs, double rhs) noexcept {
-    vec<N> ret = lhs;
+template<int N, typename T>
+vec<N, T> operator*(const vec<N, T> &lhs, typename vec<N, T>::scalar rhs) noexcept {
+    vec<N, T> ret = lhs;
     for (int i = 0; i < N; ++i) {
         ret[i] *= rhs;
     }
     return ret;
 }
 
-template<int N>
-vec<N> operator*(double lhs, const vec<N> &rhs) noexcept {
+template<int N, typename T>
+vec<N, T> operator*(typename vec<N, T>::scalar lhs, const vec<N, T> &rhs) noexcept {
     return rhs * lhs;
 }
 
-template<int N>
-vec<N> operator/(const vec<N> &lhs, double rhs) noexcept {
-    vec<N> ret = lhs;
+template<int N, typename T>
+vec<N, T> operator/(const vec<N, T> &lhs, typename vec<N, T>::scalar rhs) noexcept {
+    vec<N, T> ret = lhs;
     for (int i = 0; i < N; ++i) {
         ret[i] /= rhs;
     }
     return ret;
 }
 
-template<int N>
-std::ostream &operator<<(std::ostream &out, const vec<N> &v) {
+template<int N, typename T>
+std::ostream &operator<<(std::ostream &out, const vec<N, T> &v) {
     for (int i = 0; i < N; ++i) {
         out << v[i] << " ";
     }
     return out;
 }
 
-template<int N>
-double norm(const vec<N> &v) {
+template<int N, typename T>
+T norm(const vec<N, T> &v) {
     return std::sqrt(v * v);
 }
 
-template<int N>
-vec<N> normalized(const vec<N> &v) {
+template<int N, typename T>
+vec<N, T> normalized(const vec<N, T> &v) {
     return v / norm(v);
 }
 
-inline vec3 cross(const vec3 &v1, const vec3 &v2) noexcept {
+template<typename T>
+vec<3, T> cross(const vec<3, T> &v1, const vec<3, T> &v2) noexcept {
     return {v1.y * v2.z - v1.z * v2.y, v1.z * v2.x - v1.x * v2.z, v1.x * v2.y - v1.y * v2.x};
 }
+
+template<typename U, int N, typename T>
+vec<N, U> vec_cast(const vec<N, T> &v) noexcept {
+    vec<N, U> ret;
+    for (int i = 0; i < N; ++i) {
+        ret[i] = static_cast<U>(v[i]);
+    }
+    return ret;
+}
+
+// Structure-of-arrays batch of W vectors: component i of lane k is c[i][k], so one component of
+// every lane is contiguous and loads straight into a SIMD register.
+template<int N, int W, typename T = float>
+struct vec_soa {
+    alignas(W * sizeof(T) >= 32 ? 32 : 16) T c[N][W]{};
+
+    [[nodiscard]] vec<N, T> lane(int k) const noexcept {
+        assert(k >= 0 && k < W);
+        vec<N, T> ret;
+        for (int i = 0; i < N; ++i) {
+            ret[i] = c[i][k];
+        }
+        return ret;
+    }
+
+    void set_lane(int k, const vec<N, T> &v) noexcept {
+        assert(k >= 0 && k < W);
+        for (int i = 0; i < N; ++i) {
+            c[i][k] = v[i];
+        }
+    }
+};
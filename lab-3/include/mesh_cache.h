@@ -0,0 +1,102 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "culling.h"
+#include "math/vec.h"
+#include "vertex_format.h"
+
+// A contiguous range of faces in the model's index buffer that shares one material.
+struct SubMesh {
+    int first_face;
+    int nfaces;
+    int material;
+};
+
+// --- .trmesh ---
+// A Model in its final in-memory layout: a header followed by 16-byte aligned sections, used in
+// place once mapped. It is a cache of one source file on one machine, so it is stored in native
+// byte order and rebuilt whenever the source, a file the import read along with it (material
+// libraries), the format version or the import options change.
+
+constexpr uint32_t MESH_CACHE_VERSION   = 5;
+constexpr uint32_t MESH_CACHE_OPTIMIZED = 1u << 0;
+
+struct MeshCacheSource {
+    uint64_t size;  // bytes of the source file
+    int64_t  mtime; // last write time of the source file, in file clock ticks
+};
+
+// Size of a file the import looked for and did not find
+constexpr uint64_t MESH_CACHE_MISSING = ~uint64_t{0};
+
+// A file the importer opened, or tried to, while importing the source.
+struct MeshCacheDependency {
+    std::string     path; // absolute
+    MeshCacheSource source;
+};
+
+struct MeshCacheHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t flags;
+    MeshCacheSource source;
+
+    uint32_t nverts;
+    uint32_t nindices;
+    uint32_t nsubmeshes;
+    uint32_t nmaterials;
+    uint32_t nmeshlets;
+    uint32_t ndependencies;
+
+    // Byte offsets of the sections from the start of the file
+    uint64_t vertices;       // PackedVertex[nverts]
+    uint64_t indices;        // int[nindices]
+    uint64_t face_materials; // int[nindices / 3]
+    uint64_t submeshes;      // SubMesh[nsubmeshes]
+    uint64_t meshlets;       // Meshlet[nmeshlets], partitioning the faces of every submesh in order
+    uint64_t materials;      // per material: diffuse, normal, specular texture path, each u32 length + chars
+    uint64_t dependencies;   // per dependency: MeshCacheSource, then its path as u32 length + chars
+    uint64_t size;           // total file size
+
+    uint64_t payload_checksum; // of every byte after the header, see validate_mesh_cache
+    uint64_t checksum;         // FNV-1a of every header byte before it
+};
+
+// Everything a Model stores, in owning containers while it is imported.
+struct MeshData {
+    std::vector<PackedVertex> vertices;
+    std::vector<int>          indices;
+    std::vector<int>          face_materials;
+    std::vector<SubMesh>      submeshes;
+    std::vector<Meshlet>      meshlets;
+    std::vector<std::array<std::string, 3>> textures; // per material, relative to the source directory
+    std::vector<MeshCacheDependency>        dependencies;
+};
+
+// Size and modification time of `path`; false if it cannot be read.
+bool mesh_cache_source(const std::string &path, MeshCacheSource &source);
+
+// `path` made absolute, with its current size and modification time (MESH_CACHE_MISSING if absent).
+MeshCacheDependency mesh_cache_dependency(const std::string &path);
+
+// Serializes `mesh` into a cache image. The storage is vec4f so the image is 16-byte aligned.
+std::vector<vec4f> build_mesh_cache(const MeshData &mesh, const MeshCacheSource &source, uint32_t flags);
+
+// The header of `image` if it is a complete cache of `source` built with `flags`, else nullptr.
+// Every dependency must be unchanged and the payload must match its checksum, so that a stale or
+// corrupted file is never used in place; every index, material id and face range must also lie
+// inside its buffer, which the checksum alone does not guarantee for a crafted file. Both checks
+// read the whole payload on every load: about 25 ms for a 64 MB cache, mostly faulting in pages
+// that drawing reads anyway, against seconds for an import.
+const MeshCacheHeader *validate_mesh_cache(const std::byte *image, size_t size, const MeshCacheSource &source, uint32_t flags);
+
+// Texture paths of every material of a validated image.
+std::vector<std::array<std::string, 3>> mesh_cache_textures(const std::byte *image);
+
+// Writes the image next to the source; a failure only costs the next run another import.
+bool write_mesh_cache(const std::string &path, const std::vector<vec4f> &image);
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <vector>
+
+#include "mesh_cache.h"
+
+// Reorders the triangles of an indexed triangle list for post-transform vertex cache locality
+// (Tipsy, Sander et al. 2007). The result references the same vertices.
+std::vector<int> optimize_vertex_cache(const std::vector<int> &indices, int nverts, int cache_size = 16);
+
+// Vertex permutation that numbers vertices in order of first use by the index buffer, so vertex
+// data is fetched sequentially; unreferenced vertices go last. remap[old] = new.
+std::vector<int> optimize_vertex_fetch_remap(const std::vector<int> &indices, int nverts);
+
+// Splits the faces of each submesh, in index buffer order, into meshlets of at most max_vertices
+// unique vertices and max_faces faces, with their bounds and normal cones. Vertex cache order keeps
+// them compact.
+std::vector<Meshlet> build_meshlets(const std::vector<int> &indices, const std::vector<vec3f> &positions,
+                                    const std::vector<SubMesh> &submeshes, int max_vertices = 64, int max_faces = 124);
@@ -3,44 +3,91 @@
 #include <string>
 #include <vector>
 
+#include "array_view.h"
+#include "culling.h"
+#include "mapped_file.h"
+#include "mesh_cache.h"
+#include "texture.h"
 #include "math/vec.h"
-#include "tgaimage.h"
-#include "assimp/material.h"
 
+namespace Assimp { class Importer; }
+
+struct Material {
+    Texture2D diffuse_map;
+    Texture2D normal_map;
+    Texture2D specular_map;
+
+    // Tangent-space normal from the normal map, +z without one
+    [[nodiscard]] vec4f normal(const Sampler &sampler, const vec2f &uv, const vec2f &duv_dx, const vec2f &duv_dy) const;
+};
+
+// Every mesh of a scene file, flattened through its node hierarchy into one vertex/index arena.
+// A mesh referenced by several nodes is instanced once per node. The arena is a .trmesh image:
+// mapped in place from `<file>.trmesh` when that cache is current, otherwise imported and cached.
 class Model {
+    // --- Storage ---
+    MappedFile         cache_file;
+    std::vector<vec4f> cache_image; // used when the import could not be mapped back from the cache
+    bool               from_cache = false;
+
     // --- Mesh ---
-    std::vector<vec4> vertices;
-    std::vector<vec4> normals;
-    std::vector<vec2> uvs;
+    ArrayView<PackedVertex> vertices;
 
     // --- Faces ---
-    std::vector<int> facet_vrt;
-    std::vector<int> facet_nrm;
-    std::vector<int> facet_tex;
+    ArrayView<int> facet_vrt;
+    ArrayView<int> facet_mat;
+
+    // --- Materials ---
+    ArrayView<SubMesh>    submesh_ranges;
+    std::vector<Material> material_list;
 
-    // --- Maps ---
-    TGAImage diffuse_map;
-    TGAImage normal_map;
-    TGAImage specular_map;
+    // --- Culling ---
+    ArrayView<Meshlet> meshlet_list;
+    Bounds             model_bounds;
 
-    void load_textures(const std::string &objPath, const aiMaterial *material);
+    void use_image(const std::byte *image, const std::string &filename);
+    void compute_bounds();
 
 public:
-    explicit Model(const std::string &filename);
+    // `optimize` reorders triangles and vertices for vertex cache and fetch locality. The importer is
+    // reused across models so its allocations and post-processing setup are shared.
+    Model(Assimp::Importer &importer, const std::string &filename, bool optimize = true);
+
+    Model(const Model &) = delete;
+    Model &operator=(const Model &) = delete;
 
     [[nodiscard]] size_t nverts() const { return vertices.size(); }
     [[nodiscard]] size_t nfaces() const { return facet_vrt.size() / 3; }
 
-    [[nodiscard]] vec4 vert(const int i) const { return vertices[i]; }
-    [[nodiscard]] vec4 vert(const int iface, const int offset) const { return vertices[facet_vrt[iface * 3 + offset]]; }
+    // Packed record of a vertex; the accessors below decode one attribute of it
+    [[nodiscard]] const PackedVertex &vertex(const int i) const { return vertices[i]; }
+
+    [[nodiscard]] vec4f vert(const int i) const {
+        const float *p = vertices[i].position;
+        return {p[0], p[1], p[2], 1.f};
+    }
+    [[nodiscard]] vec4f vert(const int iface, const int offset) const { return vert(facet_vrt[iface * 3 + offset]); }
+
+    [[nodiscard]] ArrayView<int> indices() const { return facet_vrt; }
+
+    [[nodiscard]] vec4f normal(const int i) const {
+        const vec3f n = unpack_normal(vertices[i].normal);
+        return {n.x, n.y, n.z, 0.f};
+    }
+    [[nodiscard]] vec4f normal(const int iface, const int offset) const { return normal(facet_vrt[iface * 3 + offset]); }
+
+    // w: bitangent handedness
+    [[nodiscard]] vec4f tangent(const int i) const { return unpack_tangent(vertices[i].tangent); }
 
-    [[nodiscard]] vec4 normal(const int iface, const int offset) const { return normals[facet_nrm[iface * 3 + offset]]; }
-    [[nodiscard]] vec4 normal(const vec2 &uv) const;
+    [[nodiscard]] vec2f uv(const int i) const { return {half_to_float(vertices[i].uv[0]), half_to_float(vertices[i].uv[1])}; }
+    [[nodiscard]] vec2f uv(const int iface, const int offset) const { return uv(facet_vrt[iface * 3 + offset]); }
 
-    [[nodiscard]] vec2 uv(const int iface, const int offset) const { return uvs[facet_tex[iface * 3 + offset]]; }
+    [[nodiscard]] ArrayView<SubMesh> submeshes() const { return submesh_ranges; }
+    [[nodiscard]] const Material &material(const int iface) const { return material_list[facet_mat[iface]]; }
 
-    [[nodiscard]] const TGAImage &diffuse() const { return diffuse_map; }
-    [[nodiscard]] const TGAImage &specular() const { return specular_map; }
+    // Object-space bounds of every face, and the meshlets that partition the faces
+    [[nodiscard]] const Bounds &bounds() const { return model_bounds; }
+    [[nodiscard]] ArrayView<Meshlet> meshlets() const { return meshlet_list; }
 
     [[nodiscard]] std::string debug_info() const;
 };
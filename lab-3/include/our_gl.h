@@ -1,29 +1,424 @@
 #pragma once
 
+#include <algorithm>
+#include <cstdint>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
+#include "array_view.h"
+#include "coverage.h"
+#include "culling.h"
+#include "gbuffer.h"
+#include "hdr_image.h"
+#include "parallel.h"
 #include "tgaimage.h"
 #include "math/mat.h"
 
 class Camera;
 
+// Depth of a render target, larger being nearer, with the Hi-Z bounds culling tests against.
+struct DepthBuffer {
+    int width  = 0;
+    int height = 0;
+    std::vector<double> z;
+
+    // Per HI_Z_BLOCK x HI_Z_BLOCK block: a lower bound of the depths stored in z. Anything not
+    // nearer than it is hidden everywhere in the block.
+    std::vector<double> hi_z;
+    int hi_z_width = 0;
+
+    DepthBuffer() = default;
+    DepthBuffer(int width, int height);
+
+    // Back to CLEAR_DEPTH, in place
+    void clear();
+};
+
 struct Gl_Globals {
+    static constexpr double CLEAR_DEPTH = -1000.;
+    static constexpr int    HI_Z_BLOCK  = 8;
+
     static TGAImage FRAME_BUFFER;
-    static std::vector<double> Z_BUFFER;
+    // Float render target for shading beyond 1, allocated by init() only when asked for
+    static HdrImage HDR_BUFFER;
+    static DepthBuffer Z_BUFFER;
+
+    static void init(int width, int height, TGAColor clear_color, bool hdr = false);
+
+    // Resets the buffers allocated by init() for the next frame, in place.
+    static void clear(TGAColor clear_color);
+};
 
-    static void init(int width, int height, TGAColor clear_color);
+// Screen-space derivatives of the barycentrics passed to fragment(), for texture level of detail.
+struct BarycentricDerivatives {
+    vec3 dx;
+    vec3 dy;
 };
 
 struct IShader {
     virtual         ~IShader() = default;
-    
-    static TGAColor sample2D(const TGAImage &img, const vec2 &uvf) {
-        return img.get(uvf[0] * img.width(), uvf[1] * img.height());
-    }
 
-    virtual std::pair<bool, TGAColor> fragment(vec3 bar) const = 0;
+    // Per-draw uniforms, computed once before any vertex of the draw is processed.
+    virtual void draw_setup() {}
+
+    // Clip-space position of vertex `vert`. Called exactly once per vertex of a draw, from several
+    // threads at once, so varyings are stored per vertex.
+    virtual vec4 vertex(int vert) = 0;
+
+    // Per-triangle values, computed once for every triangle that survives culling, before any of
+    // its fragments are shaded. Called from several threads at once, so they are stored per face.
+    virtual void triangle_setup(int /*face*/) {}
+
+    // Discard flag and linear RGB color, 1 being the brightest an 8-bit target can show, of the
+    // fragment at pixel (x, y).
+    virtual std::pair<bool, vec3f> fragment(int x, int y, int face, vec3 bar, const BarycentricDerivatives &d) const = 0;
 };
 
+// Render targets: an 8-bit framebuffer clamps and quantizes each fragment as it is written, a float
+// one keeps it as shaded.
+inline void write_fragment(TGAImage &target, const int x, const int y, const vec3f &color) {
+    TGAColor c;
+    for (const int channel: {0, 1, 2})
+        c[channel] = quantize_unorm8(color[2 - channel]);
+    target.set(x, y, c);
+}
+
+inline void write_fragment(HdrImage &target, const int x, const int y, const vec3f &color) {
+    target.set(x, y, color);
+}
+
+// Shaders whose fragment() never discards declare `static constexpr bool never_discards = true;`
+// and the rasterizer drops the discard branch at compile time.
+template<class Shader, class = void>
+struct never_discards : std::false_type {};
+
+template<class Shader>
+struct never_discards<Shader, std::void_t<decltype(Shader::never_discards)>> : std::bool_constant<Shader::never_discards> {};
+
+template<class Shader>
+constexpr bool never_discards_v = never_discards<Shader>::value;
+
+// Shaders that only produce depth declare `static constexpr bool depth_only = true;` and need no
+// fragment(): the rasterizer stops at the depth test, without interpolating anything.
+template<class Shader, class = void>
+struct depth_only : std::false_type {};
+
+template<class Shader>
+struct depth_only<Shader, std::void_t<decltype(Shader::depth_only)>> : std::bool_constant<Shader::depth_only> {};
+
+template<class Shader>
+constexpr bool depth_only_v = depth_only<Shader>::value;
+
+// Color targets share the global depth buffer; a DepthBuffer target is a depth-only pass into it.
+inline DepthBuffer &depth_buffer_of(TGAImage &) { return Gl_Globals::Z_BUFFER; }
+inline DepthBuffer &depth_buffer_of(HdrImage &) { return Gl_Globals::Z_BUFFER; }
+inline DepthBuffer &depth_buffer_of(DepthBuffer &target) { return target; }
+
 typedef vec4 Triangle[3];
-void rasterize(const Triangle &clip, const IShader &shader, TGAImage &framebuffer, const mat4 &viewport);
+
+struct BinnedTriangle;
+
+// True if the triangle is hidden in every Hi-Z block of [x0, x1] x [y0, y1].
+bool hi_z_occluded(const BinnedTriangle &tri, const DepthBuffer &depth, int x0, int y0, int x1, int y1);
+
+// Raises the Hi-Z bound of the blocks in [x0, x1] x [y0, y1] that the triangle covers completely.
+// Only valid once every covered pixel has been depth tested against the triangle without discard.
+void hi_z_update(const BinnedTriangle &tri, DepthBuffer &depth, int x0, int y0, int x1, int y1);
+
+// Per-triangle setup: screen-space barycentrics are affine in (x, y), so they, their
+// perspective-correct counterparts (bc / w) and the depth are stepped across a row with adds only.
+// Coverage stays bit-identical to evaluating bc * {x, y, 1} per pixel: a stepped barycentric that
+// lands within the accumulated rounding error of an edge is recomputed with that exact expression.
+struct BinnedTriangle {
+    mat<3, 3> bc;     // screen barycentrics of pixel (x, y) are bc * {x, y, 1}
+    vec3      bc_dx;  // d(bc) / dx
+    vec3      bc_eps; // stepped bc closer to an edge than this is re-evaluated exactly
+    vec3      w;      // clip-space w of the corners
+    vec3      pc_dx;  // d(bc / w) / dx
+    vec3      pc_dy;  // d(bc / w) / dy
+    vec3      depth;  // ndc z of the corners
+    double    z_dx;   // d(z) / dx
+    double    zmax;   // nearest depth of the triangle
+    int       minx, miny, maxx, maxy;
+    int       face;
+    int       remap;  // clipped piece: index of the matrix mapping its barycentrics to the face's, else -1
+};
+
+// Object-space bounds of a draw. With them draw() skips a draw that is entirely outside the view,
+// and meshlets of it that are outside or face away, before any of their vertices is transformed.
+struct DrawBounds {
+    mat4               clip_from_object; // the transform the shader's vertex() applies
+    Bounds             bounds;
+    ArrayView<Meshlet> meshlets;         // together covering every face of the draw
+};
+
+// What culling removed, accumulated over draws until reset.
+struct CullStats {
+    long long draws            = 0;
+    long long draws_culled     = 0; // outside the view as a whole
+    long long meshlets             = 0;
+    long long meshlets_outside     = 0; // outside the view, vertices and faces skipped
+    long long meshlets_backfacing  = 0; // normal cone facing away, vertices and faces skipped
+    long long faces                = 0; // faces of the draws
+    long long faces_in_culled      = 0; // faces of culled draws and meshlets
+    long long faces_backfacing = 0;
+    long long faces_outside    = 0; // outside a clip plane
+    long long faces_binned     = 0; // the rest were too small to cover a pixel, or hidden by Hi-Z
+};
+
+// Sorts post-vertex triangles into screen tiles, then rasterizes every tile on a single worker
+// thread. Tiles never share pixels, so depth test and framebuffer writes need no locks, and
+// triangles are processed in submission order within a tile, so the output is deterministic.
+// Primitive assembly runs on the workers too, in chunks of faces whose bins are merged in order.
+class TileRasterizer {
+public:
+    static constexpr int TILE_SIZE = 64;
+    // Faces clipped and binned by one primitive assembly task
+    static constexpr int ASSEMBLY_CHUNK = 2048;
+
+    // Clip-space w below which geometry is clipped away (a fraction of the focal distance)
+    static constexpr double NEAR_W = 1e-2;
+    // Triangles within this many viewport widths of the screen are rasterized without clipping
+    static constexpr double GUARD_BAND = 8.;
+
+    TileRasterizer(int width, int height, const mat4 &viewport);
+
+    // For a camera that moves between draws; the tiles stay the same
+    void set_viewport(const mat4 &viewport) { viewport_ = viewport; }
+
+    // Rasterize each tile's triangles nearest first, so the depth test rejects more fragments
+    // before shading. Triangles of equal depth keep submission order.
+    void set_front_to_back(bool enabled) { front_to_back_ = enabled; }
+
+    // Off: back faces are rasterized too, for single-sided geometry that must still occlude (shadow
+    // casters seen from the light).
+    void set_cull_backfaces(bool enabled) { cull_backfaces_ = enabled; }
+
+    // Deferred mode: draws of never-discarding shaders record visibility into `gbuffer` instead of
+    // shading, and the caller runs gbuffer->resolve() once the frame is complete. Other shaders are
+    // still shaded immediately. nullptr returns to forward shading.
+    void set_gbuffer(GBuffer *gbuffer) { gbuffer_ = gbuffer; }
+
+    // Transforms each of the nverts vertices once, then assembles triangles from the index buffer.
+    // Built-in shaders are passed by their concrete type; plugins can pass an IShader &. The target
+    // is a TGAImage or an HdrImage, or a DepthBuffer for a DepthShader.
+    template<class Shader, class Target>
+    void draw(Shader &shader, int nverts, const ArrayView<int> indices, Target &framebuffer,
+              const DrawBounds *bounds = nullptr);
+
+    // Object space that lands on screen, for geometry transformed by `clip_from_object`.
+    [[nodiscard]] Frustum frustum(const mat4 &clip_from_object) const;
+
+    [[nodiscard]] const CullStats &stats() const { return stats_; }
+    void reset_stats() { stats_ = {}; }
+
+private:
+    struct FaceRange {
+        int first_face;
+        int nfaces;
+    };
+
+    // What one assembly task binned, indices local to it until merged
+    struct BinChunk {
+        FaceRange                        faces;
+        std::vector<BinnedTriangle>      triangles;
+        std::vector<mat<3, 3>>           remaps;
+        std::vector<std::pair<int, int>> entries; // (tile, triangle), in triangle order
+        CullStats                        stats;
+    };
+
+    void clear_bins(const DepthBuffer &depth);
+    bool cull_meshlets(const DrawBounds &bounds, int nverts, ArrayView<int> indices);
+    int  split_chunks();
+    void merge_chunks(int nchunks);
+    bool clip_and_bin(const Triangle &clip, int face, BinChunk &chunk) const;
+    bool bin(const Triangle &clip, int face, int remap, BinChunk &chunk) const;
+
+    template<class Shader, class Target>
+    void rasterize_tile(int tile, const Shader &shader, Target &framebuffer, DepthBuffer &depth, int draw);
+
+    int  width_;
+    int  height_;
+    int  tiles_x_;
+    int  tiles_y_;
+    mat4 viewport_;
+    bool front_to_back_  = false;
+    bool cull_backfaces_ = true;
+    GBuffer *gbuffer_ = nullptr;
+
+    std::vector<vec4>             transformed_;
+    std::vector<BinnedTriangle>   triangles_;
+    std::vector<mat<3, 3>>        remaps_;
+    std::vector<std::vector<int>> bins_;
+    std::vector<double>           tile_hi_z_;
+    std::vector<BinChunk>         chunks_;
+
+    std::vector<FaceRange>     visible_;   // face ranges left to assemble
+    std::vector<std::uint8_t>  live_;      // per vertex, when meshlets were culled: used by a visible face
+    CullStats                  stats_;
+};
+
+// Rasterizes the part of a binned triangle inside [minx, maxx] x [miny, maxy]. With a concrete
+// shader type fragment() inlines into the pixel loop; with IShader it is a virtual call.
+// With a G-buffer, visible fragments are recorded under id `draw` instead of shaded (and texels
+// the forward path shades over are released). Depth-only shaders stop after the depth write.
+template<class Shader, class Target>
+void rasterize(const BinnedTriangle &tri, const std::vector<mat<3, 3>> &remaps, const Shader &shader, Target &framebuffer,
+               DepthBuffer &depth, GBuffer *gbuffer, const int draw, const int minx, const int miny, const int maxx, const int maxy) {
+    const int x0 = std::max(tri.minx, minx), x1 = std::min(tri.maxx, maxx);
+    const int y0 = std::max(tri.miny, miny), y1 = std::min(tri.maxy, maxy);
+    if (x0 > x1 || y0 > y1 || hi_z_occluded(tri, depth, x0, y0, x1, y1)) return;
+
+    // Lane offsets and span steps; scaling by the lane count is exact
+    CoverageSetup setup{};
+    vec3 pc_offset[COVERAGE_LANES];
+    for (int k = 0; k < COVERAGE_LANES; k++) {
+        for (int i = 0; i < 3; i++)
+            setup.bc_offset.c[i][k] = tri.bc_dx[i] * k;
+        setup.z_offset[k] = tri.z_dx * k;
+        pc_offset[k] = tri.pc_dx * k;
+    }
+    for (int i = 0; i < 3; i++)
+        setup.bc_eps[i] = tri.bc_eps[i];
+    const vec3   bc_step = tri.bc_dx * COVERAGE_LANES;
+    const vec3   pc_step = tri.pc_dx * COVERAGE_LANES;
+    const double z_step  = tri.z_dx * COVERAGE_LANES;
+
+    const CoverageKernel coverage = coverage_kernel();
+
+    for (int y = y0; y <= y1; y++) {
+        // Anchor every row exactly, then step along it one span at a time
+        vec3   bc_screen = tri.bc * vec3{static_cast<double>(x0), static_cast<double>(y), 1.};
+        vec3   pc        = {bc_screen.x / tri.w.x, bc_screen.y / tri.w.y, bc_screen.z / tri.w.z};
+        double z         = bc_screen * tri.depth;
+        double *zbuf     = &depth.z[y * depth.width];
+        GBufferTexel *gbuf = gbuffer ? gbuffer->row(y) : nullptr;
+
+        for (int x = x0; x <= x1; x += COVERAGE_LANES, bc_screen = bc_screen + bc_step, pc = pc + pc_step, z += z_step) {
+            const int count = std::min(COVERAGE_LANES, x1 - x + 1);
+            auto [pass, recheck] = coverage(setup, bc_screen, z, zbuf + x, count);
+
+            for (; recheck; recheck &= recheck - 1) {
+                const int  k  = lowest_lane(recheck);
+                const vec3 bc = tri.bc * vec3{static_cast<double>(x + k), static_cast<double>(y), 1.};
+                if (bc.x < 0 || bc.y < 0 || bc.z < 0) continue;
+                if (z + setup.z_offset[k] > zbuf[x + k]) pass |= 1u << k;
+            }
+
+            if constexpr (depth_only_v<Shader>) {
+                if (pass == (1u << COVERAGE_LANES) - 1) {
+                    for (int k = 0; k < COVERAGE_LANES; k++)
+                        zbuf[x + k] = z + setup.z_offset[k];
+                    continue;
+                }
+                for (; pass; pass &= pass - 1) {
+                    const int k = lowest_lane(pass);
+                    zbuf[x + k] = z + setup.z_offset[k];
+                }
+            } else {
+                for (; pass; pass &= pass - 1) {
+                    const int  k       = lowest_lane(pass);
+                    const vec3 pc_lane = pc + pc_offset[k];
+                    const double sum = pc_lane.x + pc_lane.y + pc_lane.z;
+                    vec3 bc_clip = pc_lane / sum;
+
+                    // Quotient rule on bc_clip = pc / sum(pc), with pc affine in screen space
+                    BarycentricDerivatives d = {
+                        (tri.pc_dx - bc_clip * (tri.pc_dx.x + tri.pc_dx.y + tri.pc_dx.z)) / sum,
+                        (tri.pc_dy - bc_clip * (tri.pc_dy.x + tri.pc_dy.y + tri.pc_dy.z)) / sum
+                    };
+                    if (tri.remap >= 0) {
+                        bc_clip = bc_clip * remaps[tri.remap];
+                        d = {d.dx * remaps[tri.remap], d.dy * remaps[tri.remap]};
+                    }
+                    if (draw >= 0) {
+                        zbuf[x + k] = z + setup.z_offset[k];
+                        gbuf[x + k] = {vec_cast<float>(bc_clip), vec_cast<float>(d.dx), vec_cast<float>(d.dy), tri.face, draw};
+                        continue;
+                    }
+                    auto [discard, color] = shader.fragment(x + k, y, tri.face, bc_clip, d);
+                    if constexpr (!never_discards_v<Shader>) {
+                        if (discard) continue;
+                    }
+                    zbuf[x + k] = z + setup.z_offset[k];
+                    write_fragment(framebuffer, x + k, y, color);
+                    if (gbuf) gbuf[x + k].draw = -1;
+                }
+            }
+        }
+    }
+
+    if constexpr (never_discards_v<Shader>)
+        hi_z_update(tri, depth, x0, y0, x1, y1);
+}
+
+template<class Shader, class Target>
+void TileRasterizer::draw(Shader &shader, const int nverts, const ArrayView<int> indices, Target &framebuffer,
+                          const DrawBounds *bounds) {
+    const int nfaces = static_cast<int>(indices.size() / 3);
+    stats_.draws++;
+    stats_.faces += nfaces;
+    visible_.clear();
+    live_.clear();
+    if (bounds) {
+        if (!cull_meshlets(*bounds, nverts, indices)) return;
+    } else {
+        visible_.push_back({0, nfaces});
+    }
+
+    DepthBuffer &depth = depth_buffer_of(framebuffer);
+    clear_bins(depth);
+
+    shader.draw_setup();
+
+    // Vertex stage: every unique vertex of a visible face is shaded once
+    constexpr int batch = 1024;
+    transformed_.resize(nverts);
+    parallel_for((nverts + batch - 1) / batch, [&](const int b) {
+        for (int v = b * batch; v < std::min(nverts, (b + 1) * batch); v++)
+            if (live_.empty() || live_[v])
+                transformed_[v] = shader.vertex(v);
+    });
+
+    // Primitive assembly, chunk by chunk; merged in face order, the bins come out as if built serially
+    const int nchunks = split_chunks();
+    parallel_for(nchunks, [&](const int c) {
+        BinChunk &chunk = chunks_[c];
+        for (int f = chunk.faces.first_face; f < chunk.faces.first_face + chunk.faces.nfaces; f++) {
+            Triangle clip = {
+                transformed_[indices[f * 3]],
+                transformed_[indices[f * 3 + 1]],
+                transformed_[indices[f * 3 + 2]]
+            };
+            if (clip_and_bin(clip, f, chunk))
+                shader.triangle_setup(f);
+        }
+    });
+    merge_chunks(nchunks);
+
+    int draw = -1;
+    if constexpr (never_discards_v<Shader> && !depth_only_v<Shader>) {
+        if (gbuffer_) draw = gbuffer_->add_draw(shader);
+    }
+
+    parallel_for(static_cast<int>(bins_.size()), [&](const int tile) {
+        rasterize_tile(tile, shader, framebuffer, depth, draw);
+    });
+}
+
+template<class Shader, class Target>
+void TileRasterizer::rasterize_tile(const int tile, const Shader &shader, Target &framebuffer, DepthBuffer &depth,
+                                    const int draw) {
+    const int minx = tile % tiles_x_ * TILE_SIZE, maxx = std::min(minx + TILE_SIZE, width_) - 1;
+    const int miny = tile / tiles_x_ * TILE_SIZE, maxy = std::min(miny + TILE_SIZE, height_) - 1;
+
+    if (front_to_back_)
+        std::stable_sort(bins_[tile].begin(), bins_[tile].end(), [&](const int a, const int b) {
+            return triangles_[a].zmax > triangles_[b].zmax;
+        });
+
+    GBuffer *gbuffer = depth_only_v<Shader> ? nullptr : gbuffer_;
+    for (const int index: bins_[tile])
+        rasterize(triangles_[index], remaps_, shader, framebuffer, depth, gbuffer, draw, minx, miny, maxx, maxy);
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <functional>
+
+// Number of threads used by parallel_for (hardware concurrency, at least 1).
+unsigned worker_count();
+
+// Runs task(i) for every i in [0, count) on a pool of worker threads started on first use; the
+// calling thread participates. Indices are handed out dynamically, so tasks must only write to
+// state owned by their index.
+void parallel_for(int count, const std::function<void(int)> &task);
@@ -1,6 +1,10 @@
 #pragma once
 
+#include <vector>
+
 #include "camera.h"
+#include "camera_path.h"
+#include "light.h"
 #include "math/vec.h"
 #include "tgaimage.h"
 
@@ -11,7 +15,8 @@ struct Scene {
     int height = 800;
 
     // --- Light parameters ---
-    vec3 light{1, 1, 1};
+    vec3 light{1, 1, 1};       // directional, towards the light
+    std::vector<Light> lights; // point and spot lights, culled per screen tile
     TGAColor background{0, 0, 40, 255};
 
     // --- Camera parameters ---
@@ -25,4 +30,12 @@ struct Scene {
         camera = Camera{eye, center, up, norm(eye - center)};
         camera.init_viewport(width / 16, height / 16, width * 7 / 8, height * 7 / 8);
     }
+
+    // Moves the camera in place: shaders keep referring to the same Camera across frames
+    void set_camera(const CameraKeyframe &key) {
+        eye    = key.eye;
+        center = key.center;
+        up     = key.up;
+        apply_camera();
+    }
 };
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "../model.h"
+#include "../our_gl.h"
+
+// Positions only, for depth passes such as shadow maps: drawn into a DepthBuffer, the rasterizer
+// never interpolates attributes or calls a fragment stage.
+struct DepthShader {
+    static constexpr bool never_discards = true;
+    static constexpr bool depth_only     = true;
+
+    const Model &model;
+
+    // --- Uniforms ---
+    mat4 clip_from_object;
+
+    DepthShader(const Model &m, const mat4 &clip_from_object) : model(m), clip_from_object(clip_from_object) {}
+
+    void draw_setup() {}
+
+    [[nodiscard]] vec4 vertex(const int vert) const {
+        return clip_from_object * vec_cast<double>(model.vert(vert));
+    }
+
+    void triangle_setup(int /*face*/) {}
+};
@@ -2,53 +2,116 @@
 
 #include <algorithm>
 #include <cmath>
+#include <vector>
 
 #include "../model.h"
 #include "../camera.h"
+#include "../light_grid.h"
 #include "../our_gl.h"
+#include "../shadow_map.h"
+#include "../shadow_mask.h"
+
+struct PhongShader final : IShader {
+    static constexpr bool never_discards = true;
 
-struct PhongShader : IShader {
     const Model & model;
     const Camera &camera;
-    vec4          l;
-    vec2          varying_uv[3];
-    vec4          varying_nrm[3];
-    vec4          tri[3];
-
-    PhongShader(const vec3 &light, const Model &m, const Camera &cam) : model(m), camera(cam) { l = normalized((camera.model_view() * vec4{light.x, light.y, light.z, 0.})); }
-
-    virtual vec4 vertex(const int face, const int vert) {
-        varying_uv[vert]       = model.uv(face, vert);
-        varying_nrm[vert]      = camera.model_view().invert_transpose() * model.normal(face, vert);
-        const vec4 gl_Position = camera.model_view() * model.vert(face, vert);
-        tri[vert]              = gl_Position;
-        return camera.perspective() * gl_Position;
+    const vec3    light;
+
+    // --- Uniforms ---
+    mat4  uniform_model_view;
+    mat4  uniform_normal_matrix;
+    mat4  uniform_perspective;
+    vec4f l;
+    Sampler sampler;
+    const ShadowMask *shadows = nullptr;    // traced light visibility per pixel, deferred shading only
+    const ShadowMap  *shadow_map = nullptr; // light depth, looked up at the world position of the fragment
+    const LightGrid  *light_grid = nullptr; // point and spot lights, only those listed for the fragment's tile
+
+    // --- Varyings ---
+    std::vector<vec2f> varying_uv;
+    std::vector<vec4f> varying_nrm;
+    std::vector<vec4f> varying_pos;
+
+    // --- Per-triangle tangent basis ---
+    std::vector<vec4f> triangle_tangent;
+    std::vector<vec4f> triangle_bitangent;
+
+    PhongShader(const vec3 &light, const Model &m, const Camera &cam) : model(m), camera(cam), light(light),
+        varying_uv(m.nverts()), varying_nrm(m.nverts()), varying_pos(m.nverts()),
+        triangle_tangent(m.nfaces()), triangle_bitangent(m.nfaces()) {}
+
+    void draw_setup() override {
+        uniform_model_view    = camera.model_view();
+        uniform_normal_matrix = affine_inverse(uniform_model_view).transpose(); // lookat is a rigid transform
+        uniform_perspective   = camera.perspective();
+        l = vec_cast<float>(normalized((uniform_model_view * vec4{light.x, light.y, light.z, 0.})));
+    }
+
+    vec4 vertex(const int vert) override {
+        varying_uv[vert]       = model.uv(vert);
+        varying_nrm[vert]      = vec_cast<float>(uniform_normal_matrix * vec_cast<double>(model.normal(vert)));
+        const vec4 gl_Position = uniform_model_view * vec_cast<double>(model.vert(vert));
+        varying_pos[vert]      = vec_cast<float>(gl_Position);
+        return uniform_perspective * gl_Position;
+    }
+
+    void triangle_setup(const int face) override {
+        const int  *idx = &model.indices()[face * 3];
+        const vec2f uvs[3] = {varying_uv[idx[0]], varying_uv[idx[1]], varying_uv[idx[2]]};
+        const vec4f tri[3] = {varying_pos[idx[0]], varying_pos[idx[1]], varying_pos[idx[2]]};
+
+        const mat<2, 4, float> E = {tri[1] - tri[0], tri[2] - tri[0]};
+        const mat<2, 2, float> U = {uvs[1] - uvs[0], uvs[2] - uvs[0]};
+        const mat<2, 4, float> T = U.invert() * E;
+        triangle_tangent[face]   = normalized(T[0]);
+        triangle_bitangent[face] = normalized(T[1]);
     }
 
-    [[nodiscard]] std::pair<bool, TGAColor> fragment(const vec3 bar) const override {
-        const mat<2, 4> E = {tri[1] - tri[0], tri[2] - tri[0]};
-        const mat<2, 2> U = {varying_uv[1] - varying_uv[0], varying_uv[2] - varying_uv[0]};
-        const mat<2, 4> T = U.invert() * E;
-        const mat<4, 4> D = {
-            normalized(T[0]),
-            normalized(T[1]),
-            normalized(varying_nrm[0] * bar[0] + varying_nrm[1] * bar[1] + varying_nrm[2] * bar[2]),
-            {0, 0, 0, 1}
-        };
+    [[nodiscard]] std::pair<bool, vec3f> fragment(const int x, const int y, const int face, const vec3 bar_clip, const BarycentricDerivatives &d) const override {
+        const int  *idx = &model.indices()[face * 3];
+        const vec3f bar = vec_cast<float>(bar_clip);
+        const vec3f bar_dx = vec_cast<float>(d.dx), bar_dy = vec_cast<float>(d.dy);
+        const Material &material = model.material(face);
 
+        const vec2f uvs[3] = {varying_uv[idx[0]], varying_uv[idx[1]], varying_uv[idx[2]]};
+        const vec2f uv     = uvs[0] * bar[0] + uvs[1] * bar[1] + uvs[2] * bar[2];
+        const vec2f duv_dx = uvs[0] * bar_dx[0] + uvs[1] * bar_dx[1] + uvs[2] * bar_dx[2];
+        const vec2f duv_dy = uvs[0] * bar_dy[0] + uvs[1] * bar_dy[1] + uvs[2] * bar_dy[2];
 
-        const vec2 uv = varying_uv[0] * bar[0] + varying_uv[1] * bar[1] + varying_uv[2] * bar[2];
-        const vec4 n  = normalized(D.transpose() * model.normal(uv));
-        const vec4 r  = normalized(n * (n * l) * 2 - l);
+        // Tangent-space normal to view space: the rows of the TBN basis weighted by its components
+        const vec4f N   = normalized(varying_nrm[idx[0]] * bar[0] + varying_nrm[idx[1]] * bar[1] + varying_nrm[idx[2]] * bar[2]);
+        const vec4f tsn = material.normal(sampler, uv, duv_dx, duv_dy);
+        const vec4f n   = normalized(triangle_tangent[face] * tsn.x + triangle_bitangent[face] * tsn.y + N * tsn.z);
+        const vec4f r   = normalized(n * (n * l) * 2 - l);
 
-        constexpr double ambient  = 0.4;
-        const double     diffuse  = 1.0 * std::max(0., n * l);
-        const double     specular = (.5 + 2. * sample2D(model.specular(), uv)[0] / 255.) * std::pow(std::max(r.z, 0.), 35);
+        constexpr float ambient  = 0.4f;
+        const float     shadow   = shadows ? shadows->at(x, y) : shadow_map ? map_visibility(face, bar) : 1.f;
+        const float     gloss    = .5f + 2.f * material.specular_map.sample(sampler, uv, duv_dx, duv_dy).x;
+        const float     diffuse  = shadow * std::max(0.f, n * l);
+        const float     specular = shadow * gloss * std::pow(std::max(r.z, 0.f), 35.f);
 
-        TGAColor gl_FragColor = sample2D(model.diffuse(), uv);
-        for (const int channel: {0, 1, 2})
-            gl_FragColor[channel] = std::min<int>(255, static_cast<int>(gl_FragColor[channel] * (ambient + diffuse + specular)));
+        // Unclamped: highlights above 1 survive into a float target
+        const vec4f albedo = material.diffuse_map.sample(sampler, uv, duv_dx, duv_dy);
+        const float intensity = ambient + diffuse + specular;
+        vec3f gl_FragColor    = albedo.xyz() * intensity;
+
+        if (light_grid) {
+            const vec4f pos = varying_pos[idx[0]] * bar[0] + varying_pos[idx[1]] * bar[1] + varying_pos[idx[2]] * bar[2];
+            vec3f point_diffuse = {0, 0, 0}, point_specular = {0, 0, 0};
+            for (const int i: light_grid->lights_at(x, y))
+                accumulate_light(light_grid->light(i), pos.xyz(), n.xyz(), point_diffuse, point_specular);
+            const vec3f point = point_diffuse + point_specular * gloss;
+            gl_FragColor = gl_FragColor + vec3f{albedo.x * point.x, albedo.y * point.y, albedo.z * point.z};
+        }
 
         return {false, gl_FragColor};
     }
+
+    // Models are stored in world space: their own positions and normals are what the light sees
+    [[nodiscard]] float map_visibility(const int face, const vec3f &bar) const {
+        const vec4f world  = model.vert(face, 0) * bar[0] + model.vert(face, 1) * bar[1] + model.vert(face, 2) * bar[2];
+        const vec4f normal = model.normal(face, 0) * bar[0] + model.normal(face, 1) * bar[1] + model.normal(face, 2) * bar[2];
+        return shadow_map->visibility(world.xyz(), normalized(normal.xyz()));
+    }
 };
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "camera.h"
+#include "culling.h"
+#include "model.h"
+#include "our_gl.h"
+
+// Depth of the scene as seen from a directional light, rendered with a depth-only pass of the
+// tile rasterizer and sampled per fragment with percentage-closer filtering.
+class ShadowMap {
+public:
+    // A size x size map, averaging (2 * pcf_radius + 1)^2 depth tests per lookup.
+    ShadowMap(int size, int pcf_radius);
+
+    // Aims the light camera at the world-space box from far along `light` (the direction towards
+    // the light), with the box filling the map, and clears the depth.
+    void fit(const vec3 &light, const Aabb &scene);
+
+    // Adds the faces of a world-space model to the depth.
+    void draw(const Model &model);
+
+    // Fraction of the lookups around `world`, a point of a surface facing `normal`, that see the
+    // light; 1 outside the map.
+    [[nodiscard]] float visibility(const vec3f &world, const vec3f &normal) const;
+
+    [[nodiscard]] int size() const { return size_; }
+
+private:
+    int            size_;
+    int            pcf_radius_;
+    double         texel_ = 0; // world-space size of a texel across the scene
+    double         bias_  = 0; // in depth units
+    Camera         camera_;
+    mat4           clip_from_world_;
+    mat4           map_from_world_; // viewport * clip_from_world
+    DepthBuffer    depth_;
+    TileRasterizer rasterizer_;
+};
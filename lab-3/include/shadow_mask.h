@@ -0,0 +1,30 @@
+#pragma once
+
+#include <vector>
+
+#include "bvh.h"
+#include "math/mat.h"
+
+// Per-pixel visibility of a directional light, traced against a BVH of the scene from the surface
+// positions left in a depth buffer once a frame's visibility is resolved (deferred shading).
+class ShadowMask {
+public:
+    ShadowMask(int width, int height);
+
+    // Shoots one ray per covered pixel towards `light` (a world-space direction), a 2x2 quad of
+    // pixels per packet. Positions are reconstructed through the inverse of viewport * clip_from_world.
+    // Rays start `bias` along the light to step off their own surface.
+    void trace(const Bvh &bvh, const mat4 &clip_from_world, const mat4 &viewport, const vec3 &light,
+               const std::vector<double> &zbuffer, double clear_depth, float bias);
+
+    // 1 where the light reaches the pixel, 0 in shadow
+    [[nodiscard]] float at(const int x, const int y) const { return visibility_[x + y * width_]; }
+
+    [[nodiscard]] long long rays() const { return rays_; }
+
+private:
+    int width_;
+    int height_;
+    long long rays_ = 0;
+    std::vector<float> visibility_;
+};
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "tgaimage.h"
+#include "math/vec.h"
+
+enum class TextureFilter {
+    Point,     // nearest texel of the nearest mip level
+    Bilinear,  // 2x2 texels of the nearest mip level
+    Trilinear  // bilinear in the two nearest mip levels, blended
+};
+
+enum class TextureWrap {
+    Repeat,
+    Clamp
+};
+
+struct Sampler {
+    TextureFilter filter = TextureFilter::Trilinear;
+    TextureWrap   wrap   = TextureWrap::Repeat;
+};
+
+// RGBA8 texture with a precomputed mip pyramid, converted from a TGAImage once at load time.
+// Texel (x, y) of level 0 is image.get(x, y) and covers uv [x, x + 1) / width.
+//
+// Levels are stored as 8x8-texel tiles (256 bytes, four cache lines), tiles in row-major order
+// and texels in Morton order within a tile. A sampling footprint then touches the same few
+// lines whichever direction a triangle runs across the texture, instead of one line per row.
+class Texture2D {
+public:
+    static constexpr int TILE_SHIFT = 3;
+    static constexpr int TILE_SIZE  = 1 << TILE_SHIFT;
+
+    Texture2D() = default;
+    explicit Texture2D(const TGAImage &image, bool mipmaps = true);
+
+    [[nodiscard]] bool empty() const { return levels_.empty(); }
+    [[nodiscard]] int levels() const { return static_cast<int>(levels_.size()); }
+    [[nodiscard]] int width(const int level = 0) const { return levels_[level].width; }
+    [[nodiscard]] int height(const int level = 0) const { return levels_[level].height; }
+
+    // Level of detail of a pixel footprint, from the screen-space derivatives of uv
+    [[nodiscard]] float lod(const vec2f &duv_dx, const vec2f &duv_dy) const;
+
+    // Normalized RGBA; an empty texture samples as transparent black
+    [[nodiscard]] vec4f sample(const Sampler &sampler, const vec2f &uv, float lod = 0.f) const;
+    [[nodiscard]] vec4f sample(const Sampler &sampler, const vec2f &uv, const vec2f &duv_dx, const vec2f &duv_dy) const {
+        return sample(sampler, uv, lod(duv_dx, duv_dy));
+    }
+
+    [[nodiscard]] vec4f fetch(const int level, const int x, const int y) const {
+        const Level &l = levels_[level];
+        return unpack(l.texels[l.index(x, y)]);
+    }
+
+private:
+    struct Level {
+        int width;
+        int height;
+        int tiles_x;
+        std::vector<std::uint32_t> texels; // R, G, B, A from the low byte up
+
+        Level(int width, int height);
+
+        // A texel's index is the sum of a row and a column part: the Morton bits of x and y
+        // within a tile are disjoint, so bilinear filtering computes two of each, not four indices.
+        static constexpr std::uint8_t SPREAD[TILE_SIZE] = {0, 1, 4, 5, 16, 17, 20, 21}; // bit i to bit 2i
+
+        [[nodiscard]] size_t row(const int y) const {
+            return (static_cast<size_t>(y >> TILE_SHIFT) * tiles_x << (2 * TILE_SHIFT)) + (SPREAD[y & (TILE_SIZE - 1)] << 1);
+        }
+        [[nodiscard]] static size_t column(const int x) {
+            return (static_cast<size_t>(x >> TILE_SHIFT) << (2 * TILE_SHIFT)) + SPREAD[x & (TILE_SIZE - 1)];
+        }
+        [[nodiscard]] size_t index(const int x, const int y) const { return row(y) + column(x); }
+    };
+
+    static vec4f unpack(const std::uint32_t texel) {
+        constexpr float scale = 1.f / 255.f;
+        return {
+            static_cast<float>(texel & 0xffu) * scale,
+            static_cast<float>(texel >> 8 & 0xffu) * scale,
+            static_cast<float>(texel >> 16 & 0xffu) * scale,
+            static_cast<float>(texel >> 24) * scale
+        };
+    }
+
+    // Repeat folds uv into [0, 1] and Clamp limits it to [-1, 2], so every texel coordinate derived
+    // from it is within one texture size of the valid range; NaN samples texel 0.
+    static float wrap_uv(const float u, const TextureWrap wrap) {
+        const float w = wrap == TextureWrap::Repeat ? u - std::floor(u) : std::clamp(u, -1.f, 2.f);
+        return w == w ? w : 0.f;
+    }
+
+    static int wrap_texel(const int c, const int size, const TextureWrap wrap) {
+        if (wrap == TextureWrap::Clamp) return std::clamp(c, 0, size - 1);
+        return c < 0 ? c + size : c >= size ? c - size : c;
+    }
+
+    [[nodiscard]] static vec4f point(const Level &level, const TextureWrap wrap, const vec2f &uv) {
+        const int x = wrap_texel(static_cast<int>(wrap_uv(uv.x, wrap) * static_cast<float>(level.width)), level.width, wrap);
+        const int y = wrap_texel(static_cast<int>(wrap_uv(uv.y, wrap) * static_cast<float>(level.height)), level.height, wrap);
+        return unpack(level.texels[level.index(x, y)]);
+    }
+
+    [[nodiscard]] static vec4f bilinear(const Level &level, const TextureWrap wrap, const vec2f &uv) {
+        // Texel centers sit at half-integer coordinates
+        const float fx = wrap_uv(uv.x, wrap) * static_cast<float>(level.width) - .5f;
+        const float fy = wrap_uv(uv.y, wrap) * static_cast<float>(level.height) - .5f;
+        const float bx = std::floor(fx), by = std::floor(fy);
+        const float tx = fx - bx, ty = fy - by;
+
+        // The second neighbour wraps from the first under Repeat, so 1-texel levels stay in range
+        const int ix = static_cast<int>(bx), iy = static_cast<int>(by);
+        const int x0 = wrap_texel(ix, level.width, wrap), y0 = wrap_texel(iy, level.height, wrap);
+        const int x1 = wrap == TextureWrap::Repeat ? wrap_texel(x0 + 1, level.width, wrap) : wrap_texel(ix + 1, level.width, wrap);
+        const int y1 = wrap == TextureWrap::Repeat ? wrap_texel(y0 + 1, level.height, wrap) : wrap_texel(iy + 1, level.height, wrap);
+
+        const std::uint32_t *texels = level.texels.data();
+        const size_t r0 = level.row(y0), r1 = level.row(y1), c0 = Level::column(x0), c1 = Level::column(x1);
+        const vec4f top    = unpack(texels[r0 + c0]) * (1.f - tx) + unpack(texels[r0 + c1]) * tx;
+        const vec4f bottom = unpack(texels[r1 + c0]) * (1.f - tx) + unpack(texels[r1 + c1]) * tx;
+        return top * (1.f - ty) + bottom * ty;
+    }
+
+    std::vector<Level> levels_;
+};
+
+inline vec4f Texture2D::sample(const Sampler &sampler, const vec2f &uv, const float lod) const {
+    if (empty()) return {};
+
+    const float max_level = static_cast<float>(levels_.size() - 1);
+    const float l = std::isnan(lod) ? 0.f : std::clamp(lod, 0.f, max_level);
+
+    switch (sampler.filter) {
+        case TextureFilter::Point:
+            return point(levels_[static_cast<int>(l + .5f)], sampler.wrap, uv);
+        case TextureFilter::Bilinear:
+            return bilinear(levels_[static_cast<int>(l + .5f)], sampler.wrap, uv);
+        case TextureFilter::Trilinear:
+        default: {
+            const int   l0 = static_cast<int>(l);
+            const float t  = l - static_cast<float>(l0);
+            const vec4f c0 = bilinear(levels_[l0], sampler.wrap, uv);
+            if (t == 0.f) return c0;
+            return c0 * (1.f - t) + bilinear(levels_[l0 + 1], sampler.wrap, uv) * t;
+        }
+    }
+}
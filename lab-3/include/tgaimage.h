@@ -36,13 +36,17 @@ struct TGAImage {
     bool write_tga_file(const std::string &filename, bool vflip=true, bool rle=true) const;
     void flip_horizontally();
     void flip_vertically();
+    void clear(TGAColor c = {});
     TGAColor get(int x, int y) const;
     void set(int x, int y, const TGAColor &c);
     int width()  const;
     int height() const;
+    int bytespp() const;
+    // The w * bytespp() bytes of row y, pixels in BGR(A) order
+    const std::uint8_t *row(int y) const;
 private:
-    bool   load_rle_data(std::ifstream &in);
-    bool unload_rle_data(std::ofstream &out) const;
+    bool   load_rle_data(const std::uint8_t *in, size_t size);
+    void unload_rle_data(std::vector<std::uint8_t> &out) const;
     int w = 0, h = 0;
     std::uint8_t bpp = 0;
     std::vector<std::uint8_t> data = {};
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include "math/vec.h"
+
+// --- Packed vertex ---
+// One interleaved 24-byte record per vertex, so the vertex stage streams a single array:
+// float position, octahedral unit normal (2 x snorm16), half-precision uv and an octahedral
+// tangent (snorm16 + snorm15) with the bitangent handedness in the top bit.
+struct PackedVertex {
+    float    position[3];
+    uint32_t normal;
+    uint16_t uv[2];
+    uint32_t tangent;
+};
+
+static_assert(sizeof(PackedVertex) == 24);
+
+// --- Half precision ---
+
+inline uint16_t float_to_half(const float f) {
+    uint32_t bits;
+    std::memcpy(&bits, &f, sizeof(bits));
+    const auto sign = static_cast<uint16_t>(bits >> 16 & 0x8000u);
+    const uint32_t abs = bits & 0x7fffffffu;
+
+    if (abs >= 0x7f800000u) // inf, nan
+        return sign | 0x7c00u | (abs > 0x7f800000u ? 0x200u : 0u);
+    if (abs >= 0x477ff000u) // rounds past the largest half
+        return sign | 0x7c00u;
+    if (abs < 0x38800000u) { // half subnormal or zero: scale by 2^24 and round
+        float a;
+        std::memcpy(&a, &abs, sizeof(a));
+        return sign | static_cast<uint16_t>(std::nearbyint(a * 16777216.f));
+    }
+    // Re-bias the exponent and round the mantissa to nearest even
+    const uint32_t rounded = abs + 0xfffu + (abs >> 13 & 1u);
+    return sign | static_cast<uint16_t>((rounded - 0x38000000u) >> 13);
+}
+
+inline float half_to_float(const uint16_t h) {
+    const uint32_t sign = static_cast<uint32_t>(h & 0x8000u) << 16;
+    const uint32_t exponent = h >> 10 & 0x1fu, mantissa = h & 0x3ffu;
+
+    float f;
+    if (exponent == 0) {
+        f = static_cast<float>(mantissa) * (1.f / 16777216.f);
+    } else {
+        const uint32_t bits = exponent == 31 ? 0x7f800000u | mantissa << 13 : (exponent + 112) << 23 | mantissa << 13;
+        std::memcpy(&f, &bits, sizeof(f));
+    }
+    return sign ? -f : f;
+}
+
+// --- Octahedral unit vectors ---
+
+inline vec2f oct_wrap(const vec2f &v) {
+    return {(1.f - std::abs(v.y)) * (v.x >= 0 ? 1.f : -1.f), (1.f - std::abs(v.x)) * (v.y >= 0 ? 1.f : -1.f)};
+}
+
+// Projects a unit vector onto the octahedron and unfolds it onto [-1, 1]^2.
+inline vec2f oct_encode(const vec3f &n) {
+    const float l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    if (l1 == 0) return {0, 0};
+    const vec2f p = {n.x / l1, n.y / l1};
+    return n.z >= 0 ? p : oct_wrap(p);
+}
+
+inline vec3f oct_decode(const vec2f &p) {
+    vec3f n = {p.x, p.y, 1.f - std::abs(p.x) - std::abs(p.y)};
+    const float t = std::max(-n.z, 0.f);
+    n.x += n.x >= 0 ? -t : t;
+    n.y += n.y >= 0 ? -t : t;
+    const float length = std::sqrt(n * n);
+    return length > 0 ? vec3f{n.x / length, n.y / length, n.z / length} : vec3f{0, 0, 1};
+}
+
+inline uint32_t snorm(const float v, const int bits) {
+    const auto scale = static_cast<float>((1 << (bits - 1)) - 1);
+    return static_cast<uint32_t>(static_cast<int32_t>(std::lround(std::clamp(v, -1.f, 1.f) * scale))) & ((1u << bits) - 1);
+}
+
+inline float unsnorm(const uint32_t v, const int bits) {
+    const auto scale = static_cast<float>((1 << (bits - 1)) - 1);
+    const int32_t s = static_cast<int32_t>(v << (32 - bits)) >> (32 - bits); // sign extend
+    return std::max(static_cast<float>(s) / scale, -1.f);
+}
+
+inline uint32_t pack_normal(const vec3f &n) {
+    const vec2f p = oct_encode(n);
+    return snorm(p.x, 16) | snorm(p.y, 16) << 16;
+}
+
+inline vec3f unpack_normal(const uint32_t packed) {
+    return oct_decode({unsnorm(packed & 0xffffu, 16), unsnorm(packed >> 16, 16)});
+}
+
+// w < 0 for a mirrored tangent frame
+inline uint32_t pack_tangent(const vec4f &t) {
+    const vec2f p = oct_encode(t.xyz());
+    return snorm(p.x, 16) | snorm(p.y, 15) << 16 | (t.w < 0 ? 1u << 31 : 0u);
+}
+
+inline vec4f unpack_tangent(const uint32_t packed) {
+    const vec3f t = oct_decode({unsnorm(packed & 0xffffu, 16), unsnorm(packed >> 16 & 0x7fffu, 15)});
+    return {t.x, t.y, t.z, packed >> 31 ? -1.f : 1.f};
+}
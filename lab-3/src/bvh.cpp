@@ -0,0 +1,333 @@
+#include "bvh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <numeric>
+
+#include "coverage.h"
+#include "parallel.h"
+
+namespace {
+constexpr int   BINS           = 16;
+constexpr int   MAX_LEAF       = 8;
+constexpr float TRAVERSAL_COST = 1.f; // in triangle tests
+constexpr int   MAX_SAH_DEPTH  = 64;  // deeper ranges are halved, which bounds the traversal stack
+constexpr int   STACK_SIZE     = 128;
+
+struct Primitive {
+    Aabb  box;
+    vec3f centroid;
+};
+
+float half_area(const Aabb &box) {
+    if (box.empty()) return 0;
+    const vec3f d = box.max - box.min;
+    return d.x * d.y + d.y * d.z + d.z * d.x;
+}
+
+void merge(Aabb &box, const Aabb &other) {
+    if (other.empty()) return;
+    box.expand(other.min);
+    box.expand(other.max);
+}
+
+class Builder {
+public:
+    Builder(const std::vector<Primitive> &primitives, std::vector<int> &order) : primitives_(primitives), order_(order) {}
+
+    // Bounds of order[begin, end), which is then partitioned in place. Returns where the second
+    // child starts, or -1 when a leaf is cheaper.
+    int split(const int begin, const int end, const int depth, Aabb &box) const {
+        Aabb centroids;
+        box = {};
+        for (int i = begin; i < end; i++) {
+            merge(box, primitives_[order_[i]].box);
+            centroids.expand(primitives_[order_[i]].centroid);
+        }
+        const int n = end - begin;
+        if (n <= 2) return -1;
+
+        if (depth >= MAX_SAH_DEPTH) {
+            if (n <= MAX_LEAF) return -1;
+            const vec3f extent = centroids.max - centroids.min;
+            const int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+            std::nth_element(order_.begin() + begin, order_.begin() + begin + n / 2, order_.begin() + end, [&](const int a, const int b) {
+                return primitives_[a].centroid[axis] < primitives_[b].centroid[axis];
+            });
+            return begin + n / 2;
+        }
+
+        float best_cost = std::numeric_limits<float>::max();
+        int   best_axis = -1, best_bin = 0;
+        for (int axis = 0; axis < 3; axis++) {
+            const float extent = centroids.max[axis] - centroids.min[axis];
+            if (extent <= 0) continue;
+
+            Aabb bin_box[BINS];
+            int  bin_count[BINS] = {};
+            for (int i = begin; i < end; i++) {
+                const Primitive &p = primitives_[order_[i]];
+                const int b = bin(p.centroid[axis], centroids.min[axis], extent);
+                bin_count[b]++;
+                merge(bin_box[b], p.box);
+            }
+
+            // Cost of the right side of every split, then sweep the left side across
+            float right_cost[BINS];
+            Aabb  right;
+            int   right_count = 0;
+            for (int b = BINS - 1; b > 0; b--) {
+                merge(right, bin_box[b]);
+                right_count += bin_count[b];
+                right_cost[b] = half_area(right) * static_cast<float>(right_count);
+            }
+            Aabb left;
+            int  left_count = 0;
+            for (int b = 0; b < BINS - 1; b++) {
+                merge(left, bin_box[b]);
+                left_count += bin_count[b];
+                const float cost = half_area(left) * static_cast<float>(left_count) + right_cost[b + 1];
+                if (left_count > 0 && left_count < n && cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_bin  = b;
+                }
+            }
+        }
+
+        if (best_axis < 0) {
+            // Coincident centroids: no plane separates them, halve the range if it is too long
+            return n <= MAX_LEAF ? -1 : begin + n / 2;
+        }
+        const float sah = TRAVERSAL_COST + best_cost / half_area(box);
+        if (sah >= static_cast<float>(n) && n <= MAX_LEAF) return -1;
+
+        const float min = centroids.min[best_axis], extent = centroids.max[best_axis] - min;
+        return static_cast<int>(std::partition(order_.begin() + begin, order_.begin() + end, [&](const int i) {
+            return bin(primitives_[i].centroid[best_axis], min, extent) <= best_bin;
+        }) - order_.begin());
+    }
+
+    // Depth-first nodes of the subtree over order[begin, end); inner node indices are relative to
+    // the start of `out`.
+    void build(const int begin, const int end, const int depth, std::vector<BvhNode> &out) const {
+        const int node = static_cast<int>(out.size());
+        out.emplace_back();
+        Aabb box;
+        const int mid = split(begin, end, depth, box);
+        out[node].min = box.min;
+        out[node].max = box.max;
+        if (mid < 0) {
+            out[node].index = begin;
+            out[node].count = end - begin;
+            return;
+        }
+        build(begin, mid, depth + 1, out);
+        out[node].index = static_cast<int>(out.size());
+        out[node].count = 0;
+        build(mid, end, depth + 1, out);
+    }
+
+private:
+    static int bin(const float c, const float min, const float extent) {
+        return std::min(BINS - 1, static_cast<int>((c - min) * (BINS / extent)));
+    }
+
+    const std::vector<Primitive> &primitives_;
+    std::vector<int>             &order_;
+};
+
+// Upper level of the tree, split serially until the ranges are small enough to build in parallel.
+struct TopNode {
+    Aabb box;
+    int  left  = -1;
+    int  right = -1;
+    int  task  = -1; // index of the subtree built in parallel, for the lowest top nodes
+    int  depth = 0;
+};
+
+// Slab test of a ray against a node's box
+bool hit_box(const BvhNode &node, const vec3f &origin, const vec3f &inv_dir, const float tmin, const float tmax) {
+    float t0 = tmin, t1 = tmax;
+    for (int a = 0; a < 3; a++) {
+        const float near = (node.min[a] - origin[a]) * inv_dir[a];
+        const float far  = (node.max[a] - origin[a]) * inv_dir[a];
+        t0 = std::max(t0, std::min(near, far));
+        t1 = std::min(t1, std::max(near, far));
+    }
+    return t0 <= t1;
+}
+
+// Moller-Trumbore, both sides
+bool hit_triangle(const BvhTriangle &tri, const vec3f &origin, const vec3f &dir, const float tmin, const float tmax) {
+    const vec3f p   = cross(dir, tri.e2);
+    const float det = tri.e1 * p;
+    if (std::abs(det) < 1e-12f) return false;
+    const float inv = 1.f / det;
+    const vec3f s = origin - tri.v0;
+    const float u = (s * p) * inv;
+    if (u < 0 || u > 1) return false;
+    const vec3f q = cross(s, tri.e1);
+    const float v = (dir * q) * inv;
+    if (v < 0 || u + v > 1) return false;
+    const float t = (tri.e2 * q) * inv;
+    return t > tmin && t < tmax;
+}
+
+vec3f inverse(const vec3f &dir) {
+    constexpr float inf = std::numeric_limits<float>::infinity();
+    return {dir.x != 0 ? 1.f / dir.x : inf, dir.y != 0 ? 1.f / dir.y : inf, dir.z != 0 ? 1.f / dir.z : inf};
+}
+}
+
+Bvh::Bvh(const std::vector<BvhTriangle> &triangles) {
+    const int n = static_cast<int>(triangles.size());
+    if (n == 0) return;
+
+    std::vector<Primitive> primitives(n);
+    parallel_for((n + 4095) / 4096, [&](const int b) {
+        for (int i = b * 4096; i < std::min(n, (b + 1) * 4096); i++) {
+            const BvhTriangle &t = triangles[i];
+            Aabb box;
+            box.expand(t.v0);
+            box.expand(t.v0 + t.e1);
+            box.expand(t.v0 + t.e2);
+            primitives[i] = {box, (box.min + box.max) * .5f};
+        }
+    });
+    std::vector<int> order(n);
+    std::iota(order.begin(), order.end(), 0);
+    const Builder builder(primitives, order);
+
+    // A few subtrees per thread balance the uneven splits
+    const int grain = std::max(1024, n / static_cast<int>(8 * worker_count()));
+    std::vector<TopNode> top;
+    std::vector<std::pair<int, int>> tasks;
+    const std::function<int(int, int, int)> plan = [&](const int begin, const int end, const int depth) {
+        const int node = static_cast<int>(top.size());
+        top.emplace_back();
+        top[node].depth = depth;
+        int mid = -1;
+        if (end - begin > grain) mid = builder.split(begin, end, depth, top[node].box);
+        if (mid < 0) {
+            top[node].task = static_cast<int>(tasks.size());
+            tasks.emplace_back(begin, end);
+            return node;
+        }
+        const int left  = plan(begin, mid, depth + 1);
+        const int right = plan(mid, end, depth + 1);
+        top[node].left  = left;
+        top[node].right = right;
+        return node;
+    };
+    plan(0, n, 0);
+
+    std::vector<int> top_depth(tasks.size());
+    for (const TopNode &node: top)
+        if (node.task >= 0) top_depth[node.task] = node.depth;
+
+    std::vector<std::vector<BvhNode>> subtrees(tasks.size());
+    parallel_for(static_cast<int>(tasks.size()), [&](const int t) {
+        builder.build(tasks[t].first, tasks[t].second, top_depth[t], subtrees[t]);
+    });
+
+    const std::function<void(int)> emit = [&](const int t) {
+        const TopNode &node = top[t];
+        if (node.task >= 0) {
+            const int offset = static_cast<int>(nodes_.size());
+            for (BvhNode sub: subtrees[node.task]) {
+                if (sub.count == 0) sub.index += offset;
+                nodes_.push_back(sub);
+            }
+            return;
+        }
+        const int index = static_cast<int>(nodes_.size());
+        nodes_.push_back({node.box.min, 0, node.box.max, 0});
+        emit(node.left);
+        nodes_[index].index = static_cast<int>(nodes_.size());
+        emit(node.right);
+    };
+    size_t total = top.size();
+    for (const std::vector<BvhNode> &subtree: subtrees)
+        total += subtree.size();
+    nodes_.reserve(total);
+    emit(0);
+
+    // Leaves reference contiguous triangles
+    triangles_.resize(n);
+    for (int i = 0; i < n; i++)
+        triangles_[i] = triangles[order[i]];
+}
+
+Aabb Bvh::bounds() const {
+    if (nodes_.empty()) return {};
+    return {nodes_[0].min, nodes_[0].max};
+}
+
+bool Bvh::occluded(const vec3f &origin, const vec3f &dir, const float tmin, const float tmax) const {
+    if (nodes_.empty()) return false;
+    const vec3f inv_dir = inverse(dir);
+
+    int stack[STACK_SIZE];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        const BvhNode &node = nodes_[stack[--top]];
+        if (!hit_box(node, origin, inv_dir, tmin, tmax)) continue;
+        if (node.count > 0) {
+            for (int i = node.index; i < node.index + node.count; i++)
+                if (hit_triangle(triangles_[i], origin, dir, tmin, tmax)) return true;
+            continue;
+        }
+        const int first = static_cast<int>(&node - nodes_.data()) + 1;
+        stack[top++] = node.index;
+        stack[top++] = first;
+    }
+    return false;
+}
+
+unsigned Bvh::occluded(const RayPacket &packet) const {
+    if (nodes_.empty() || !packet.active) return 0;
+    const vec3f inv_dir = inverse(packet.dir);
+
+    unsigned blocked = 0;
+    int stack[STACK_SIZE];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        const BvhNode &node = nodes_[stack[--top]];
+
+        // Slab test of every lane still looking for a blocker
+        unsigned lanes = 0;
+        for (int k = 0; k < RAY_PACKET; k++) {
+            const float nx = (node.min.x - packet.ox[k]) * inv_dir.x, fx = (node.max.x - packet.ox[k]) * inv_dir.x;
+            const float ny = (node.min.y - packet.oy[k]) * inv_dir.y, fy = (node.max.y - packet.oy[k]) * inv_dir.y;
+            const float nz = (node.min.z - packet.oz[k]) * inv_dir.z, fz = (node.max.z - packet.oz[k]) * inv_dir.z;
+            const float t0 = std::max({packet.tmin, std::min(nx, fx), std::min(ny, fy), std::min(nz, fz)});
+            const float t1 = std::min({packet.tmax[k], std::max(nx, fx), std::max(ny, fy), std::max(nz, fz)});
+            lanes |= static_cast<unsigned>(t0 <= t1) << k;
+        }
+        lanes &= packet.active & ~blocked;
+        if (!lanes) continue;
+
+        if (node.count > 0) {
+            for (int i = node.index; i < node.index + node.count && lanes; i++) {
+                for (unsigned rest = lanes; rest; rest &= rest - 1) {
+                    const int k = lowest_lane(rest);
+                    if (hit_triangle(triangles_[i], {packet.ox[k], packet.oy[k], packet.oz[k]}, packet.dir, packet.tmin, packet.tmax[k])) {
+                        blocked |= 1u << k;
+                        lanes &= ~(1u << k);
+                    }
+                }
+            }
+            if (blocked == packet.active) return blocked;
+            continue;
+        }
+        const int first = static_cast<int>(&node - nodes_.data()) + 1;
+        stack[top++] = node.index;
+        stack[top++] = first;
+    }
+    return blocked;
+}
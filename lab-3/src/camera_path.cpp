@@ -0,0 +1,45 @@
+#include "camera_path.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+bool load_camera_path(const std::string &filename, std::vector<CameraKeyframe> &path) {
+    std::ifstream in(filename);
+    if (!in.is_open()) {
+        std::cerr << "can't open file " << filename << "\n";
+        return false;
+    }
+    path.clear();
+    std::string line;
+    for (int number = 1; std::getline(in, line); number++) {
+        const size_t start = line.find_first_not_of(" \t\r");
+        if (start == std::string::npos || line[start] == '#') continue;
+
+        std::istringstream fields(line);
+        CameraKeyframe key{};
+        fields >> key.eye.x >> key.eye.y >> key.eye.z >> key.center.x >> key.center.y >> key.center.z
+               >> key.up.x >> key.up.y >> key.up.z;
+        if (fields.fail()) {
+            std::cerr << filename << ":" << number << ": expected eye, center and up (9 numbers)\n";
+            return false;
+        }
+        path.push_back(key);
+    }
+    if (path.empty()) {
+        std::cerr << filename << ": no keyframes\n";
+        return false;
+    }
+    return true;
+}
+
+CameraKeyframe camera_path_at(const std::vector<CameraKeyframe> &path, const double t) {
+    const double s = std::clamp(t, 0., 1.) * static_cast<double>(path.size() - 1);
+    const size_t i = std::min(static_cast<size_t>(s), path.size() - 1);
+    if (i + 1 == path.size()) return path[i];
+
+    const double f = s - static_cast<double>(i);
+    const CameraKeyframe &a = path[i], &b = path[i + 1];
+    return {a.eye + (b.eye - a.eye) * f, a.center + (b.center - a.center) * f, a.up + (b.up - a.up) * f};
+}
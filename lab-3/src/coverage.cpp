@@ -0,0 +1,127 @@
+#include "coverage.h"
+
+#include <cmath>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define COVERAGE_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define COVERAGE_TARGET_AVX2
+#else
+#define COVERAGE_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+static CoverageMask coverage_scalar(const CoverageSetup &setup, const vec3 &bc, const double z, const double *zbuf, const int count) {
+    CoverageMask mask = {0, 0};
+    for (int k = 0; k < count; k++) {
+        const double b0 = bc.x + setup.bc_offset.c[0][k];
+        const double b1 = bc.y + setup.bc_offset.c[1][k];
+        const double b2 = bc.z + setup.bc_offset.c[2][k];
+        if (std::abs(b0) < setup.bc_eps[0] || std::abs(b1) < setup.bc_eps[1] || std::abs(b2) < setup.bc_eps[2]) {
+            mask.recheck |= 1u << k;
+            continue;
+        }
+        if (b0 < 0 || b1 < 0 || b2 < 0) continue;
+        if (z + setup.z_offset[k] > zbuf[k]) mask.pass |= 1u << k;
+    }
+    return mask;
+}
+
+#ifdef COVERAGE_X86
+
+static CoverageMask coverage_sse2(const CoverageSetup &setup, const vec3 &bc, const double z, const double *zbuf, const int count) {
+    if (count < COVERAGE_LANES) return coverage_scalar(setup, bc, z, zbuf, count);
+
+    const __m128d sign = _mm_set1_pd(-0.0);
+    const __m128d zero = _mm_setzero_pd();
+    const __m128d base[3] = {_mm_set1_pd(bc.x), _mm_set1_pd(bc.y), _mm_set1_pd(bc.z)};
+    const __m128d eps[3] = {_mm_set1_pd(setup.bc_eps[0]), _mm_set1_pd(setup.bc_eps[1]), _mm_set1_pd(setup.bc_eps[2])};
+
+    CoverageMask mask = {0, 0};
+    for (int half = 0; half < COVERAGE_LANES; half += 2) {
+        __m128d inside = _mm_castsi128_pd(_mm_set1_epi32(-1));
+        __m128d near_edge = zero;
+        for (int i = 0; i < 3; i++) {
+            const __m128d b = _mm_add_pd(base[i], _mm_load_pd(&setup.bc_offset.c[i][half]));
+            inside = _mm_and_pd(inside, _mm_cmpge_pd(b, zero));
+            near_edge = _mm_or_pd(near_edge, _mm_cmplt_pd(_mm_andnot_pd(sign, b), eps[i]));
+        }
+        const __m128d depth = _mm_add_pd(_mm_set1_pd(z), _mm_loadu_pd(&setup.z_offset[half]));
+        const __m128d closer = _mm_cmpgt_pd(depth, _mm_loadu_pd(zbuf + half));
+
+        const unsigned recheck = _mm_movemask_pd(near_edge);
+        mask.recheck |= recheck << half;
+        mask.pass |= (_mm_movemask_pd(_mm_and_pd(inside, closer)) & ~recheck) << half;
+    }
+    return mask;
+}
+
+COVERAGE_TARGET_AVX2
+static CoverageMask coverage_avx2(const CoverageSetup &setup, const vec3 &bc, const double z, const double *zbuf, const int count) {
+    const __m256i lanes = _mm256_cmpgt_epi64(_mm256_set1_epi64x(count), _mm256_setr_epi64x(0, 1, 2, 3));
+
+    const __m256d sign = _mm256_set1_pd(-0.0);
+    const __m256d zero = _mm256_setzero_pd();
+    const double base[3] = {bc.x, bc.y, bc.z};
+
+    __m256d inside = _mm256_castsi256_pd(lanes);
+    __m256d near_edge = zero;
+    for (int i = 0; i < 3; i++) {
+        const __m256d b = _mm256_add_pd(_mm256_set1_pd(base[i]), _mm256_load_pd(setup.bc_offset.c[i]));
+        inside = _mm256_and_pd(inside, _mm256_cmp_pd(b, zero, _CMP_GE_OQ));
+        near_edge = _mm256_or_pd(near_edge, _mm256_cmp_pd(_mm256_andnot_pd(sign, b), _mm256_set1_pd(setup.bc_eps[i]), _CMP_LT_OQ));
+    }
+    near_edge = _mm256_and_pd(near_edge, _mm256_castsi256_pd(lanes));
+
+    const __m256d depth = _mm256_add_pd(_mm256_set1_pd(z), _mm256_loadu_pd(setup.z_offset));
+    const __m256d closer = _mm256_cmp_pd(depth, _mm256_maskload_pd(zbuf, lanes), _CMP_GT_OQ);
+
+    const unsigned recheck = _mm256_movemask_pd(near_edge);
+    return {_mm256_movemask_pd(_mm256_and_pd(inside, closer)) & ~recheck, recheck};
+}
+
+static bool cpu_has_avx2() {
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return false;
+    __cpuid(info, 1);
+    const bool osxsave = info[2] & (1 << 27), avx = info[2] & (1 << 28);
+    if (!osxsave || !avx || (_xgetbv(0) & 6) != 6) return false;
+    __cpuidex(info, 7, 0);
+    return info[1] & (1 << 5);
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif
+
+namespace {
+struct Dispatch {
+    CoverageKernel kernel;
+    const char    *name;
+};
+
+const Dispatch &dispatch() {
+    static const Dispatch selected = [] () -> Dispatch {
+#ifdef COVERAGE_X86
+        if (cpu_has_avx2()) return {coverage_avx2, "avx2"};
+        return {coverage_sse2, "sse2"};
+#else
+        return {coverage_scalar, "scalar"};
+#endif
+    }();
+    return selected;
+}
+}
+
+CoverageKernel coverage_kernel() {
+    return dispatch().kernel;
+}
+
+const char *coverage_kernel_name() {
+    return dispatch().name;
+}
@@ -0,0 +1,45 @@
+#include "culling.h"
+
+#include <cmath>
+
+Frustum::Frustum(const mat4 &m, const vec2 &ndc_min, const vec2 &ndc_max, const double near_w) {
+    planes_[0] = m[0] - m[3] * ndc_min.x;
+    planes_[1] = m[3] * ndc_max.x - m[0];
+    planes_[2] = m[1] - m[3] * ndc_min.y;
+    planes_[3] = m[3] * ndc_max.y - m[1];
+    planes_[4] = m[3];
+    planes_[4].w -= near_w;
+
+    // A projection without an eye point (orthographic) gets no cone culling
+    const mat<3, 3> A = {{m[0].x, m[0].y, m[0].z}, {m[1].x, m[1].y, m[1].z}, {m[3].x, m[3].y, m[3].z}};
+    if (std::abs(A.det()) > 1e-12) {
+        eye_ = A.invert() * vec3{-m[0].w, -m[1].w, -m[3].w};
+        has_eye_ = true;
+    }
+}
+
+bool Frustum::culled(const BoundingSphere &sphere) const {
+    for (const vec4 &p: planes_) {
+        const double distance = p.x * sphere.center.x + p.y * sphere.center.y + p.z * sphere.center.z + p.w;
+        if (distance < -sphere.radius * std::sqrt(p.x * p.x + p.y * p.y + p.z * p.z)) return true;
+    }
+    return false;
+}
+
+bool Frustum::backfacing(const Meshlet &meshlet) const {
+    if (!has_eye_ || meshlet.cone_cutoff >= 1) return false;
+    const vec3 view = vec_cast<double>(meshlet.bounds.sphere.center) - eye_;
+    return view * vec_cast<double>(meshlet.cone_axis) >= meshlet.cone_cutoff * norm(view) + meshlet.bounds.sphere.radius;
+}
+
+bool Frustum::culled(const Aabb &box) const {
+    if (box.empty()) return true;
+    for (const vec4 &p: planes_) {
+        // The corner furthest along the plane normal
+        const double x = p.x > 0 ? box.max.x : box.min.x;
+        const double y = p.y > 0 ? box.max.y : box.min.y;
+        const double z = p.z > 0 ? box.max.z : box.min.z;
+        if (p.x * x + p.y * y + p.z * z + p.w < 0) return true;
+    }
+    return false;
+}
@@ -0,0 +1,83 @@
+#include "frame_writer.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "image_io.h"
+
+FrameWriter::FrameWriter(const int threads, const int queue_depth) : queue_depth_(std::max(1, queue_depth)) {
+    for (int t = 0; t < std::max(1, threads); t++)
+        threads_.emplace_back([this] { work(); });
+}
+
+FrameWriter::~FrameWriter() {
+    {
+        std::lock_guard lock(mutex_);
+        stopping_ = true;
+    }
+    pending_ready_.notify_all();
+    for (std::thread &t: threads_)
+        t.join();
+}
+
+// The first frames through the pipeline allocate their copies; later ones trade buffers
+template<class Image>
+static void hand_over(Image &mine, Image &theirs) {
+    if (mine.width() == theirs.width() && mine.height() == theirs.height())
+        std::swap(mine, theirs);
+    else
+        mine = theirs;
+}
+
+void FrameWriter::submit(const std::string &filename, TGAImage &ldr, HdrImage *hdr) {
+    Frame frame;
+    {
+        std::unique_lock lock(mutex_);
+        frame_done_.wait(lock, [&] { return in_flight_ < queue_depth_; });
+        in_flight_++;
+        if (!free_.empty()) {
+            frame = std::move(free_.back());
+            free_.pop_back();
+        }
+    }
+
+    frame.filename = filename;
+    hand_over(frame.ldr, ldr);
+    frame.has_hdr = hdr != nullptr;
+    if (hdr) hand_over(frame.hdr, *hdr);
+
+    {
+        std::lock_guard lock(mutex_);
+        pending_.push_back(std::move(frame));
+    }
+    pending_ready_.notify_one();
+}
+
+bool FrameWriter::finish() {
+    std::unique_lock lock(mutex_);
+    frame_done_.wait(lock, [&] { return in_flight_ == 0; });
+    return !failed_;
+}
+
+void FrameWriter::work() {
+    for (;;) {
+        Frame frame;
+        {
+            std::unique_lock lock(mutex_);
+            pending_ready_.wait(lock, [&] { return stopping_ || !pending_.empty(); });
+            if (pending_.empty()) return;
+            frame = std::move(pending_.front());
+            pending_.pop_front();
+        }
+
+        const bool written = write_image(frame.filename, frame.ldr, frame.has_hdr ? &frame.hdr : nullptr);
+
+        {
+            std::lock_guard lock(mutex_);
+            failed_ = failed_ || !written;
+            free_.push_back(std::move(frame));
+            in_flight_--;
+        }
+        frame_done_.notify_all();
+    }
+}
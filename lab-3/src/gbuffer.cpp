@@ -0,0 +1,39 @@
+#include "gbuffer.h"
+
+#include <algorithm>
+
+#include "our_gl.h"
+#include "parallel.h"
+
+GBuffer::GBuffer(const int width, const int height) : width_(width), height_(height), texels_(width * height) {}
+
+void GBuffer::clear() {
+    std::fill(texels_.begin(), texels_.end(), GBufferTexel{});
+    draws_.clear();
+}
+
+int GBuffer::add_draw(const IShader &shader) {
+    draws_.push_back(&shader);
+    return static_cast<int>(draws_.size()) - 1;
+}
+
+template<class Target>
+void GBuffer::resolve_into(Target &framebuffer) const {
+    parallel_for(height_, [&](const int y) {
+        const GBufferTexel *texel = &texels_[y * width_];
+        for (int x = 0; x < width_; x++, texel++) {
+            if (texel->draw < 0) continue;
+            // The rasterizer already applied the depth test; shaders given to a G-buffer never discard
+            const BarycentricDerivatives d = {vec_cast<double>(texel->bar_dx), vec_cast<double>(texel->bar_dy)};
+            write_fragment(framebuffer, x, y, draws_[texel->draw]->fragment(x, y, texel->face, vec_cast<double>(texel->bar), d).second);
+        }
+    });
+}
+
+void GBuffer::resolve(TGAImage &framebuffer) const {
+    resolve_into(framebuffer);
+}
+
+void GBuffer::resolve(HdrImage &framebuffer) const {
+    resolve_into(framebuffer);
+}
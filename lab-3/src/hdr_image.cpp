@@ -0,0 +1,33 @@
+#include "hdr_image.h"
+
+#include <cmath>
+
+#include "parallel.h"
+
+HdrImage::HdrImage(const int width, const int height, const vec3f &clear) : width_(width), height_(height),
+    pixels_(static_cast<size_t>(width) * height, clear) {}
+
+static float tonemap_channel(const float v, const Tonemap op) {
+    switch (op) {
+        case Tonemap::Reinhard:
+            return v / (1.f + v);
+        case Tonemap::Aces:
+            return v * (2.51f * v + .03f) / (v * (2.43f * v + .59f) + .14f);
+        case Tonemap::Clamp:
+        default:
+            return v;
+    }
+}
+
+void tonemap(const HdrImage &src, TGAImage &dst, const Tonemap op, const float exposure) {
+    const float scale = std::exp2(exposure);
+    parallel_for(src.height(), [&](const int y) {
+        const vec3f *row = src.row(y);
+        for (int x = 0; x < src.width(); x++) {
+            TGAColor c;
+            for (int channel = 0; channel < 3; channel++)
+                c[2 - channel] = quantize_unorm8(tonemap_channel(std::max(row[x][channel] * scale, 0.f), op));
+            dst.set(x, y, c);
+        }
+    });
+}
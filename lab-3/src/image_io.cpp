@@ -0,0 +1,110 @@
+#include "image_io.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+static bool write_file(const std::string &filename, const std::vector<std::uint8_t> &bytes) {
+    std::ofstream out(filename, std::ios::binary);
+    if (!out.is_open()) {
+        std::cerr << "can't open file " << filename << "\n";
+        return false;
+    }
+    out.write(reinterpret_cast<const char *>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+    if (!out.good()) {
+        std::cerr << "can't write " << filename << "\n";
+        return false;
+    }
+    return true;
+}
+
+static void append_header(std::vector<std::uint8_t> &bytes, const std::string &header) {
+    bytes.insert(bytes.end(), header.begin(), header.end());
+}
+
+// Framebuffer rows run bottom-up
+static void append_rgb8(std::vector<std::uint8_t> &bytes, const TGAImage &image) {
+    const int    w = image.width(), bpp = image.bytespp();
+    const size_t rowbytes = static_cast<size_t>(w) * 3;
+    size_t at = bytes.size();
+    bytes.resize(at + rowbytes * image.height());
+    for (int y = image.height() - 1; y >= 0; y--, at += rowbytes) {
+        const std::uint8_t *in  = image.row(y);
+        std::uint8_t       *out = bytes.data() + at;
+        if (bpp == TGAImage::GRAYSCALE) {
+            for (int x = 0; x < w; x++, out += 3)
+                out[0] = out[1] = out[2] = in[x];
+        } else {
+            for (int x = 0; x < w; x++, in += bpp, out += 3) {
+                out[0] = in[2];
+                out[1] = in[1];
+                out[2] = in[0];
+            }
+        }
+    }
+}
+
+static void append_rgb32f(std::vector<std::uint8_t> &bytes, const HdrImage &image, const bool top_down) {
+    const size_t rowbytes = image.width() * sizeof(vec3f);
+    for (int i = 0; i < image.height(); i++) {
+        const int y = top_down ? image.height() - 1 - i : i;
+        const size_t at = bytes.size();
+        bytes.resize(at + rowbytes);
+        std::memcpy(bytes.data() + at, image.row(y), rowbytes);
+    }
+}
+
+bool write_ppm(const std::string &filename, const TGAImage &image) {
+    std::vector<std::uint8_t> bytes;
+    const std::string header = "P6\n" + std::to_string(image.width()) + " " + std::to_string(image.height()) + "\n255\n";
+    bytes.reserve(header.size() + static_cast<size_t>(image.width()) * image.height() * 3);
+    append_header(bytes, header);
+    append_rgb8(bytes, image);
+    return write_file(filename, bytes);
+}
+
+bool write_pfm(const std::string &filename, const HdrImage &image) {
+    std::vector<std::uint8_t> bytes;
+    // A negative scale marks little-endian floats; the pixels are written in host order
+    const std::uint16_t probe = 1;
+    const bool little_endian = *reinterpret_cast<const std::uint8_t *>(&probe) == 1;
+    const std::string header = "PF\n" + std::to_string(image.width()) + " " + std::to_string(image.height()) + "\n" +
+                               (little_endian ? "-1.0\n" : "1.0\n");
+    bytes.reserve(header.size() + static_cast<size_t>(image.width()) * image.height() * sizeof(vec3f));
+    append_header(bytes, header);
+    append_rgb32f(bytes, image, false);
+    return write_file(filename, bytes);
+}
+
+bool write_raw(const std::string &filename, const TGAImage &image) {
+    std::vector<std::uint8_t> bytes;
+    bytes.reserve(static_cast<size_t>(image.width()) * image.height() * 3);
+    append_rgb8(bytes, image);
+    return write_file(filename, bytes);
+}
+
+bool write_raw(const std::string &filename, const HdrImage &image) {
+    std::vector<std::uint8_t> bytes;
+    bytes.reserve(static_cast<size_t>(image.width()) * image.height() * sizeof(vec3f));
+    append_rgb32f(bytes, image, true);
+    return write_file(filename, bytes);
+}
+
+bool ends_with(const std::string &s, const std::string &suffix) {
+    return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+bool write_image(const std::string &filename, const TGAImage &ldr, const HdrImage *hdr) {
+    if (ends_with(filename, ".pfm")) {
+        if (!hdr) {
+            std::cerr << filename << ": PFM output needs a float image\n";
+            return false;
+        }
+        return write_pfm(filename, *hdr);
+    }
+    if (ends_with(filename, ".raw")) return hdr ? write_raw(filename, *hdr) : write_raw(filename, ldr);
+    if (ends_with(filename, ".ppm")) return write_ppm(filename, ldr);
+    return ldr.write_tga_file(filename);
+}
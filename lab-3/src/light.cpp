@@ -0,0 +1,30 @@
+#include "light.h"
+
+#include <random>
+
+std::vector<Light> scatter_lights(const int count, const Aabb &box) {
+    std::vector<Light> lights;
+    if (count <= 0 || box.empty()) return lights;
+
+    const vec3f size   = box.max - box.min;
+    const float radius = 1.5f * std::max({size.x, size.z, 1e-3f}) / std::sqrt(static_cast<float>(count));
+    // The same brightness at half its radius, whatever the radius
+    const float intensity = .2f * (1.f + radius * radius / 4.f);
+
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> unit(0.f, 1.f);
+    for (int i = 0; i < count; i++) {
+        Light light;
+        light.position = vec_cast<double>(vec3f{box.min.x + size.x * unit(rng), box.min.y + (size.y + .5f * radius) * unit(rng),
+                                                box.min.z + size.z * unit(rng)});
+        light.color  = vec3f{.3f + .7f * unit(rng), .3f + .7f * unit(rng), .3f + .7f * unit(rng)} * intensity;
+        light.radius = radius;
+        if (i % 4 == 3) {
+            light.direction = normalized(vec3{unit(rng) - .5, -1., unit(rng) - .5});
+            light.cos_outer = .766f; // 40 degrees
+            light.cos_inner = .906f; // 25 degrees
+        }
+        lights.push_back(light);
+    }
+    return lights;
+}
@@ -0,0 +1,108 @@
+#include "light_grid.h"
+
+#include <algorithm>
+#include <limits>
+
+#include "parallel.h"
+
+LightGrid::LightGrid(const int width, const int height) : width_(width), height_(height),
+    tiles_x_((width + TILE_SIZE - 1) / TILE_SIZE), tiles_y_((height + TILE_SIZE - 1) / TILE_SIZE),
+    tile_zmin_(tiles_x_ * tiles_y_), tile_zmax_(tiles_x_ * tiles_y_), tiles_(tiles_x_ * tiles_y_) {}
+
+long long LightGrid::entries() const {
+    long long count = 0;
+    for (const std::vector<int> &tile: tiles_)
+        count += static_cast<long long>(tile.size());
+    return count;
+}
+
+void LightGrid::build(const ArrayView<Light> lights, const Camera &camera, const DepthBuffer *depth) {
+    constexpr double infinity = std::numeric_limits<double>::infinity();
+    const int  nlights         = static_cast<int>(lights.size());
+    const mat4 clip_from_world = camera.perspective() * camera.model_view();
+
+    view_lights_.resize(nlights);
+    extents_.resize(nlights);
+    constexpr int batch = 256;
+    parallel_for((nlights + batch - 1) / batch, [&](const int b) {
+        for (int i = b * batch; i < std::min(nlights, (b + 1) * batch); i++) {
+            const Light &light = lights[i];
+            const vec3f  position  = vec_cast<float>((camera.model_view() * vec4{light.position.x, light.position.y, light.position.z, 1.}).xyz());
+            const vec3f  direction = vec_cast<float>(normalized((camera.model_view() * vec4{light.direction.x, light.direction.y, light.direction.z, 0.}).xyz()));
+            view_lights_[i] = {position, light.radius, light.color, light.cos_outer, direction, light.cos_inner};
+
+            // The box around the sphere, clipped where the rasterizer clips geometry (w = NEAR_W): its
+            // screen position and depth are extreme at the corners of what remains
+            vec4 clip[8];
+            for (int c = 0; c < 8; c++)
+                clip[c] = clip_from_world * vec4{light.position.x + (c & 1 ? light.radius : -light.radius),
+                                                 light.position.y + (c & 2 ? light.radius : -light.radius),
+                                                 light.position.z + (c & 4 ? light.radius : -light.radius), 1.};
+            double minx = infinity, miny = infinity, maxx = -infinity, maxy = -infinity;
+            Extent extent = {0, 0, -1, -1, infinity, -infinity};
+            auto add = [&](const vec4 &point) {
+                const vec4 screen = camera.viewport() * (point / point.w);
+                minx = std::min(minx, screen.x);
+                maxx = std::max(maxx, screen.x);
+                miny = std::min(miny, screen.y);
+                maxy = std::max(maxy, screen.y);
+                extent.zmin = std::min(extent.zmin, screen.z);
+                extent.zmax = std::max(extent.zmax, screen.z);
+            };
+            for (int c = 0; c < 8; c++) {
+                if (clip[c].w >= TileRasterizer::NEAR_W) add(clip[c]);
+                for (const int axis: {1, 2, 4}) {
+                    if (c & axis) continue;
+                    const vec4 &a = clip[c], &b = clip[c | axis];
+                    if ((a.w >= TileRasterizer::NEAR_W) != (b.w >= TileRasterizer::NEAR_W))
+                        add(a + (b - a) * ((TileRasterizer::NEAR_W - a.w) / (b.w - a.w)));
+                }
+            }
+
+            // Pixels are sampled at their integer coordinates; nothing in front of the eye and the box stays empty
+            const double x0 = std::ceil(std::max(minx, 0.)), x1 = std::floor(std::min(maxx, width_ - 1.));
+            const double y0 = std::ceil(std::max(miny, 0.)), y1 = std::floor(std::min(maxy, height_ - 1.));
+            if (x0 <= x1 && y0 <= y1) {
+                extent.x0 = static_cast<int>(x0) / TILE_SIZE;
+                extent.x1 = static_cast<int>(x1) / TILE_SIZE;
+                extent.y0 = static_cast<int>(y0) / TILE_SIZE;
+                extent.y1 = static_cast<int>(y1) / TILE_SIZE;
+            }
+            extents_[i] = extent;
+        }
+    });
+
+    parallel_for(tiles_y_, [&](const int ty) {
+        for (int tx = 0; tx < tiles_x_; tx++) {
+            const int tile = tx + ty * tiles_x_;
+            double zmin = -infinity, zmax = infinity;
+            if (depth) {
+                // Depths of the geometry drawn in the tile; none and no light reaches it
+                zmin = infinity;
+                zmax = -infinity;
+                for (int y = ty * TILE_SIZE; y < std::min((ty + 1) * TILE_SIZE, height_); y++) {
+                    const double *row = &depth->z[y * depth->width];
+                    for (int x = tx * TILE_SIZE; x < std::min((tx + 1) * TILE_SIZE, width_); x++) {
+                        if (row[x] == Gl_Globals::CLEAR_DEPTH) continue;
+                        zmin = std::min(zmin, row[x]);
+                        zmax = std::max(zmax, row[x]);
+                    }
+                }
+            }
+            tile_zmin_[tile] = zmin;
+            tile_zmax_[tile] = zmax;
+            tiles_[tile].clear();
+        }
+
+        // Lights in index order, so every tile lists them in increasing order
+        for (int i = 0; i < nlights; i++) {
+            const Extent &extent = extents_[i];
+            if (ty < extent.y0 || ty > extent.y1) continue;
+            for (int tx = extent.x0; tx <= extent.x1; tx++) {
+                const int tile = tx + ty * tiles_x_;
+                if (extent.zmax >= tile_zmin_[tile] && extent.zmin <= tile_zmax_[tile])
+                    tiles_[tile].push_back(i);
+            }
+        }
+    });
+}
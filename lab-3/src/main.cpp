@@ -1,37 +1,258 @@
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
 #include <iostream>
+#include <string>
+#include <vector>
 
+#include <assimp/Importer.hpp>
+
+#include "bvh.h"
 #include "camera.h"
+#include "frame_writer.h"
+#include "image_io.h"
+#include "light_grid.h"
 #include "our_gl.h"
 #include "scene.h"
+#include "shadow_map.h"
+#include "shadow_mask.h"
 #include "model.h"
 #include "shaders/phong_shader.h"
 
+// Every face of every model; models are stored in world space
+static std::vector<BvhTriangle> scene_triangles(const std::deque<Model> &models) {
+    std::vector<BvhTriangle> triangles;
+    for (const Model &model: models) {
+        for (int f = 0; f < static_cast<int>(model.nfaces()); f++) {
+            const vec3f a = model.vert(f, 0).xyz(), b = model.vert(f, 1).xyz(), c = model.vert(f, 2).xyz();
+            triangles.push_back({a, b - a, c - a});
+        }
+    }
+    return triangles;
+}
+
+// out.tga -> out_0007.tga
+static std::string numbered(const std::string &path, const int frame) {
+    const size_t slash = path.find_last_of("/\\");
+    const size_t dot   = path.find_last_of('.');
+    const size_t split = dot != std::string::npos && (slash == std::string::npos || dot > slash) ? dot : path.size();
+    char number[16];
+    std::snprintf(number, sizeof(number), "_%04d", frame);
+    return path.substr(0, split) + number + path.substr(split);
+}
+
 int main(const int argc, char **argv) {
-    if (argc < 2) {
-        std::cerr << "Usage: " << argv[0] << " obj/model.obj" << std::endl;
+    bool        deferred = false;
+    bool        hdr      = false;
+    bool        shadows  = false;
+    bool        sorted   = false;
+    int         map_size = 0;
+    int         pcf      = 1;
+    int         nlights  = 0;
+    Tonemap     op       = Tonemap::Clamp;
+    float       exposure = 0.f;
+    std::string output   = "framebuffer.tga";
+    std::string camera_path;
+    int         nframes  = 0;
+    int         writers  = 2;
+    int         queue    = 4;
+    int first = 1;
+    for (; first < argc && argv[first][0] == '-'; first++) {
+        const bool has_value = first + 1 < argc;
+        if (std::strcmp(argv[first], "--deferred") == 0) {
+            deferred = true;
+        } else if (std::strcmp(argv[first], "--front-to-back") == 0) {
+            sorted = true;
+        } else if (std::strcmp(argv[first], "--shadows") == 0) {
+            shadows = true;
+        } else if (std::strcmp(argv[first], "--shadow-map") == 0) {
+            // Optional size: the next argument when it is a number
+            map_size = has_value && std::isdigit(static_cast<unsigned char>(argv[first + 1][0])) ? std::atoi(argv[++first]) : 1024;
+        } else if (std::strcmp(argv[first], "--pcf") == 0 && has_value) {
+            pcf = std::atoi(argv[++first]);
+        } else if (std::strcmp(argv[first], "--lights") == 0 && has_value) {
+            nlights = std::atoi(argv[++first]);
+        } else if (std::strcmp(argv[first], "--hdr") == 0) {
+            hdr = true;
+        } else if (std::strcmp(argv[first], "--exposure") == 0 && has_value) {
+            exposure = std::strtof(argv[++first], nullptr);
+        } else if (std::strcmp(argv[first], "--tonemap") == 0 && has_value) {
+            const std::string name = argv[++first];
+            op = name == "reinhard" ? Tonemap::Reinhard : name == "aces" ? Tonemap::Aces : Tonemap::Clamp;
+        } else if (std::strcmp(argv[first], "--camera-path") == 0 && has_value) {
+            camera_path = argv[++first];
+        } else if (std::strcmp(argv[first], "--frames") == 0 && has_value) {
+            nframes = std::atoi(argv[++first]);
+        } else if (std::strcmp(argv[first], "--writers") == 0 && has_value) {
+            writers = std::atoi(argv[++first]);
+        } else if (std::strcmp(argv[first], "--queue-depth") == 0 && has_value) {
+            queue = std::atoi(argv[++first]);
+        } else if (std::strcmp(argv[first], "-o") == 0 && has_value) {
+            output = argv[++first];
+        } else {
+            break;
+        }
+    }
+    if (argc <= first || (shadows && map_size > 0)) {
+        std::cerr << "Usage: " << argv[0] << " [--deferred] [--front-to-back] [--shadows | --shadow-map [size] [--pcf radius]] [--lights n] [--hdr] [--tonemap clamp|reinhard|aces] [--exposure ev]"
+                  << " [--camera-path keys.txt [--frames n]]"
+                  << " [--writers n] [--queue-depth n] [-o out.tga|.ppm|.pfm|.raw] obj/model.obj..." << std::endl;
         return 1;
     }
+    hdr = hdr || ends_with(output, ".pfm");
+    // Shadow rays start from the resolved depth buffer, so shading waits for visibility
+    deferred = deferred || shadows;
+    const bool float_output = hdr && (ends_with(output, ".pfm") || ends_with(output, ".raw"));
 
     Scene scene{};
     scene.apply_camera();
-    const mat4 viewport = scene.camera.viewport();
 
-    Gl_Globals::init(scene.width, scene.height, scene.background);
+    // Batch mode: one numbered output per frame, evenly spaced along the path (one per keyframe by default)
+    std::vector<CameraKeyframe> path;
+    if (!camera_path.empty()) {
+        if (!load_camera_path(camera_path, path)) return 1;
+        if (nframes <= 0) nframes = static_cast<int>(path.size());
+    }
+    const bool batch = !path.empty();
+    if (!batch) nframes = 1;
+
+    Gl_Globals::init(scene.width, scene.height, scene.background, hdr);
+    TileRasterizer rasterizer(scene.width, scene.height, scene.camera.viewport());
+    rasterizer.set_front_to_back(sorted);
+
+    GBuffer gbuffer(scene.width, scene.height);
+    if (deferred) rasterizer.set_gbuffer(&gbuffer);
+
+    // Assets are imported once and every frame reuses them, along with all frame buffers. Deferred
+    // shading reads the models and shaders of every draw when the frame is resolved.
+    std::deque<Model>       models;
+    std::deque<PhongShader> shaders;
+    Assimp::Importer        importer;
+    for (int m = first; m < argc; m++) {
+        const Model &model = models.emplace_back(importer, argv[m]);
+        shaders.emplace_back(scene.light, model, scene.camera);
+    }
+
+    // The scene is static: one BVH serves every frame
+    Bvh        bvh;
+    ShadowMask shadow_mask(scene.width, scene.height);
+    float      shadow_bias = 0;
+    if (shadows) {
+        const auto start = std::chrono::steady_clock::now();
+        bvh = Bvh(scene_triangles(models));
+        const auto end = std::chrono::steady_clock::now();
+        std::cout << "Shadow BVH: " << bvh.ntriangles() << " triangles, " << bvh.nnodes() << " nodes in "
+                  << std::chrono::duration<double, std::milli>(end - start).count() << " ms" << std::endl;
 
-    for (int m = 1; m < argc; m++) {
-        Model model(argv[m]);
-        PhongShader shader(scene.light, model, scene.camera);
+        const Aabb box = bvh.bounds();
+        shadow_bias = box.empty() ? 0.f : 1e-4f * norm(box.max - box.min);
+        for (PhongShader &shader: shaders)
+            shader.shadows = &shadow_mask;
+    }
+
+    Aabb scene_box;
+    for (const Model &model: models) {
+        scene_box.expand(model.bounds().box.min);
+        scene_box.expand(model.bounds().box.max);
+    }
+
+    // The light's depth is rendered again for every frame's camera
+    ShadowMap shadow_map(std::max(map_size, 1), pcf);
+    double    map_ms = 0;
+    if (map_size > 0) {
+        for (PhongShader &shader: shaders)
+            shader.shadow_map = &shadow_map;
+    }
+
+    // Light lists are rebuilt per frame: before the draws when shading forward, from the finished
+    // depth buffer (bounding each tile's depths) when deferred
+    scene.lights = scatter_lights(nlights, scene_box);
+    LightGrid light_grid(scene.width, scene.height);
+    double    grid_ms = 0;
+    if (!scene.lights.empty()) {
+        for (PhongShader &shader: shaders)
+            shader.light_grid = &light_grid;
+    }
+    auto build_light_grid = [&](const DepthBuffer *depth) {
+        const auto grid_start = std::chrono::steady_clock::now();
+        light_grid.build(scene.lights, scene.camera, depth);
+        grid_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - grid_start).count();
+    };
 
-        for (int f = 0; f < model.nfaces(); f++) {
-            Triangle clip = {
-                shader.vertex(f, 0),
-                shader.vertex(f, 1),
-                shader.vertex(f, 2)
-            };
+    // Frame N is encoded and written while frame N + 1 renders
+    FrameWriter writer(writers, queue);
+    double      render_ms = 0;
+    for (int frame = 0; frame < nframes; frame++) {
+        if (batch) {
+            scene.set_camera(camera_path_at(path, nframes > 1 ? frame / static_cast<double>(nframes - 1) : 0.));
+            if (frame > 0) {
+                Gl_Globals::clear(scene.background);
+                gbuffer.clear();
+            }
+        }
 
-            rasterize(clip, shader, Gl_Globals::FRAME_BUFFER, viewport);
+        // Depth pass from the light, over the part of the scene around what the camera looks at: a
+        // floor running to the horizon would otherwise spread the texels too thin
+        if (map_size > 0) {
+            const auto  map_start = std::chrono::steady_clock::now();
+            const float reach     = 2.f * static_cast<float>(norm(scene.eye - scene.center));
+            Aabb focus;
+            for (int i = 0; i < 3; i++) {
+                focus.min[i] = std::max(scene_box.min[i], static_cast<float>(scene.center[i]) - reach);
+                focus.max[i] = std::min(scene_box.max[i], static_cast<float>(scene.center[i]) + reach);
+            }
+            shadow_map.fit(scene.light, focus);
+            for (const Model &model: models)
+                shadow_map.draw(model);
+            map_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - map_start).count();
         }
+
+        const auto start = std::chrono::steady_clock::now();
+        if (!scene.lights.empty() && !deferred) build_light_grid(nullptr);
+        const mat4 clip_from_world = scene.camera.perspective() * scene.camera.model_view();
+        for (size_t m = 0; m < models.size(); m++) {
+            const Model &model = models[m];
+            const DrawBounds bounds = {clip_from_world, model.bounds(), model.meshlets()};
+            if (hdr)
+                rasterizer.draw(shaders[m], static_cast<int>(model.nverts()), model.indices(), Gl_Globals::HDR_BUFFER, &bounds);
+            else
+                rasterizer.draw(shaders[m], static_cast<int>(model.nverts()), model.indices(), Gl_Globals::FRAME_BUFFER, &bounds);
+        }
+
+        if (shadows)
+            shadow_mask.trace(bvh, clip_from_world, scene.camera.viewport(), scene.light, Gl_Globals::Z_BUFFER.z,
+                              Gl_Globals::CLEAR_DEPTH, shadow_bias);
+        if (!scene.lights.empty() && deferred) build_light_grid(&Gl_Globals::Z_BUFFER);
+        if (deferred) {
+            if (hdr)
+                gbuffer.resolve(Gl_Globals::HDR_BUFFER);
+            else
+                gbuffer.resolve(Gl_Globals::FRAME_BUFFER);
+        }
+        if (hdr) tonemap(Gl_Globals::HDR_BUFFER, Gl_Globals::FRAME_BUFFER, op, exposure);
+        render_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        writer.submit(batch ? numbered(output, frame) : output, Gl_Globals::FRAME_BUFFER,
+                      float_output ? &Gl_Globals::HDR_BUFFER : nullptr);
     }
 
-    return Gl_Globals::FRAME_BUFFER.write_tga_file("framebuffer.tga") ? 0 : 1;
+    if (map_size > 0)
+        std::cout << "Shadow map: " << map_size << "x" << map_size << " in " << map_ms / nframes << " ms, main pass in "
+                  << render_ms / nframes << " ms per frame" << std::endl;
+
+    if (!scene.lights.empty())
+        std::cout << "Lights: " << scene.lights.size() << ", " << static_cast<double>(light_grid.entries()) / light_grid.ntiles()
+                  << " per tile in the last frame, lists built in " << grid_ms / nframes << " ms per frame" << std::endl;
+
+    const CullStats &stats = rasterizer.stats();
+    std::cout << "Culling: " << stats.draws_culled << "/" << stats.draws << " draws, "
+              << stats.meshlets_outside << " outside + " << stats.meshlets_backfacing << " backfacing/"
+              << stats.meshlets << " meshlets; faces: "
+              << stats.faces << " submitted, " << stats.faces_in_culled << " culled with their draw or meshlet, "
+              << stats.faces_backfacing << " backfacing, " << stats.faces_outside << " outside, "
+              << stats.faces_binned << " binned" << std::endl;
+    return writer.finish() ? 0 : 1;
 }
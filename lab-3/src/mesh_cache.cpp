@@ -0,0 +1,250 @@
+#include "mesh_cache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <system_error>
+
+static constexpr char MAGIC[8] = {'T', 'R', 'M', 'E', 'S', 'H', '\0', '\0'};
+
+static uint64_t fnv1a(const std::byte *data, const size_t size) {
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= static_cast<uint64_t>(data[i]);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+static uint64_t header_checksum(const MeshCacheHeader &header) {
+    return fnv1a(reinterpret_cast<const std::byte *>(&header), offsetof(MeshCacheHeader, checksum));
+}
+
+static uint64_t align16(const uint64_t offset) {
+    return (offset + 15) & ~uint64_t{15};
+}
+
+// FNV-1a over 8-byte words in four interleaved streams, so the multiplies overlap; the payload
+// starts 16-byte aligned and its size is a multiple of 16
+static uint64_t payload_checksum(const std::byte *image, const uint64_t size) {
+    const uint64_t begin = align16(sizeof(MeshCacheHeader));
+    uint64_t lanes[4] = {14695981039346656037ull, 1, 2, 3};
+    uint64_t offset = begin;
+    for (; offset + 4 * sizeof(uint64_t) <= size; offset += 4 * sizeof(uint64_t))
+        for (int l = 0; l < 4; l++) {
+            uint64_t word;
+            std::memcpy(&word, image + offset + l * sizeof(uint64_t), sizeof(word));
+            lanes[l] = (lanes[l] ^ word) * 1099511628211ull;
+        }
+    for (int l = 0; offset < size; offset += sizeof(uint64_t), l++) {
+        uint64_t word = 0;
+        std::memcpy(&word, image + offset, std::min<uint64_t>(sizeof(word), size - offset));
+        lanes[l] = (lanes[l] ^ word) * 1099511628211ull;
+    }
+    return fnv1a(reinterpret_cast<const std::byte *>(lanes), sizeof(lanes));
+}
+
+static std::byte *write_string(std::byte *out, const std::string &s) {
+    const auto length = static_cast<uint32_t>(s.size());
+    std::memcpy(out, &length, sizeof(length));
+    std::memcpy(out + sizeof(length), s.data(), length);
+    return out + sizeof(length) + length;
+}
+
+// False when the string would run past `end`
+static bool read_string(const std::byte *&in, const std::byte *end, std::string &s) {
+    uint32_t length = 0;
+    if (end - in < static_cast<std::ptrdiff_t>(sizeof(length))) return false;
+    std::memcpy(&length, in, sizeof(length));
+    in += sizeof(length);
+    if (end - in < static_cast<std::ptrdiff_t>(length)) return false;
+    s.assign(reinterpret_cast<const char *>(in), length);
+    in += length;
+    return true;
+}
+
+// A section of `count` items of `item` bytes, aligned and inside the file (without overflowing)
+static bool section_inside(const uint64_t offset, const uint64_t count, const uint64_t item, const uint64_t size) {
+    return offset % 16 == 0 && offset <= size && count <= (size - offset) / item;
+}
+
+bool mesh_cache_source(const std::string &path, MeshCacheSource &source) {
+    std::error_code ec;
+    const auto size  = std::filesystem::file_size(path, ec);
+    if (ec) return false;
+    const auto mtime = std::filesystem::last_write_time(path, ec);
+    if (ec) return false;
+
+    source = {static_cast<uint64_t>(size), static_cast<int64_t>(mtime.time_since_epoch().count())};
+    return true;
+}
+
+MeshCacheDependency mesh_cache_dependency(const std::string &path) {
+    std::error_code ec;
+    const std::filesystem::path absolute = std::filesystem::absolute(path, ec);
+    MeshCacheDependency dependency = {ec ? path : absolute.lexically_normal().string(), {MESH_CACHE_MISSING, 0}};
+    if (!mesh_cache_source(dependency.path, dependency.source))
+        dependency.source = {MESH_CACHE_MISSING, 0};
+    return dependency;
+}
+
+std::vector<vec4f> build_mesh_cache(const MeshData &mesh, const MeshCacheSource &source, const uint32_t flags) {
+    MeshCacheHeader header{};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version    = MESH_CACHE_VERSION;
+    header.flags      = flags;
+    header.source     = source;
+    header.nverts     = static_cast<uint32_t>(mesh.vertices.size());
+    header.nindices   = static_cast<uint32_t>(mesh.indices.size());
+    header.nsubmeshes = static_cast<uint32_t>(mesh.submeshes.size());
+    header.nmaterials = static_cast<uint32_t>(mesh.textures.size());
+    header.nmeshlets  = static_cast<uint32_t>(mesh.meshlets.size());
+    header.ndependencies = static_cast<uint32_t>(mesh.dependencies.size());
+
+    uint64_t materials_size = 0;
+    for (const auto &paths: mesh.textures)
+        for (const std::string &path: paths)
+            materials_size += sizeof(uint32_t) + path.size();
+    uint64_t dependencies_size = 0;
+    for (const MeshCacheDependency &dependency: mesh.dependencies)
+        dependencies_size += sizeof(MeshCacheSource) + sizeof(uint32_t) + dependency.path.size();
+
+    uint64_t offset = align16(sizeof(MeshCacheHeader));
+    auto section = [&](uint64_t &field, const uint64_t bytes) {
+        field  = offset;
+        offset = align16(offset + bytes);
+    };
+    section(header.vertices, mesh.vertices.size() * sizeof(PackedVertex));
+    section(header.indices, mesh.indices.size() * sizeof(int));
+    section(header.face_materials, mesh.face_materials.size() * sizeof(int));
+    section(header.submeshes, mesh.submeshes.size() * sizeof(SubMesh));
+    section(header.meshlets, mesh.meshlets.size() * sizeof(Meshlet));
+    section(header.materials, materials_size);
+    section(header.dependencies, dependencies_size);
+    header.size     = offset;
+
+    std::vector<vec4f> image(header.size / sizeof(vec4f));
+    auto *base = reinterpret_cast<std::byte *>(image.data());
+    auto copy = [&](const uint64_t field, const auto &v) {
+        if (!v.empty()) std::memcpy(base + field, v.data(), v.size() * sizeof(v[0]));
+    };
+    copy(header.vertices, mesh.vertices);
+    copy(header.indices, mesh.indices);
+    copy(header.face_materials, mesh.face_materials);
+    copy(header.submeshes, mesh.submeshes);
+    copy(header.meshlets, mesh.meshlets);
+
+    std::byte *out = base + header.materials;
+    for (const auto &paths: mesh.textures)
+        for (const std::string &path: paths)
+            out = write_string(out, path);
+
+    out = base + header.dependencies;
+    for (const MeshCacheDependency &dependency: mesh.dependencies) {
+        std::memcpy(out, &dependency.source, sizeof(MeshCacheSource));
+        out = write_string(out + sizeof(MeshCacheSource), dependency.path);
+    }
+
+    header.payload_checksum = payload_checksum(base, header.size);
+    header.checksum         = header_checksum(header);
+    std::memcpy(base, &header, sizeof(header));
+    return image;
+}
+
+// Every dependency recorded in the image still has the recorded size and modification time
+static bool dependencies_unchanged(const std::byte *image, const MeshCacheHeader &header) {
+    const std::byte *in = image + header.dependencies, *end = image + header.size;
+    for (uint32_t i = 0; i < header.ndependencies; i++) {
+        MeshCacheSource recorded{};
+        if (end - in < static_cast<std::ptrdiff_t>(sizeof(recorded))) return false;
+        std::memcpy(&recorded, in, sizeof(recorded));
+        in += sizeof(recorded);
+
+        std::string path;
+        if (!read_string(in, end, path)) return false;
+        const MeshCacheSource current = mesh_cache_dependency(path).source;
+        if (current.size != recorded.size || current.mtime != recorded.mtime) return false;
+    }
+    return true;
+}
+
+// Indices, material ids and face ranges stay inside the buffers they refer to
+static bool payload_in_bounds(const std::byte *image, const MeshCacheHeader &header) {
+    const auto *indices        = reinterpret_cast<const int *>(image + header.indices);
+    const auto *face_materials = reinterpret_cast<const int *>(image + header.face_materials);
+    const auto *submeshes      = reinterpret_cast<const SubMesh *>(image + header.submeshes);
+    const auto *meshlets       = reinterpret_cast<const Meshlet *>(image + header.meshlets);
+    const auto  nverts         = static_cast<int64_t>(header.nverts);
+    const auto  nmaterials     = static_cast<int64_t>(header.nmaterials);
+    const auto  nfaces         = static_cast<int64_t>(header.nindices / 3);
+
+    bool inside = true;
+    for (uint32_t i = 0; i < header.nindices; i++)
+        inside &= indices[i] >= 0 && indices[i] < nverts;
+    for (int64_t f = 0; f < nfaces; f++)
+        inside &= face_materials[f] >= 0 && face_materials[f] < nmaterials;
+    if (!inside) return false;
+
+    auto range_inside = [&](const int first_face, const int count) {
+        return first_face >= 0 && count >= 0 && first_face <= nfaces - count;
+    };
+    for (uint32_t s = 0; s < header.nsubmeshes; s++)
+        if (!range_inside(submeshes[s].first_face, submeshes[s].nfaces) ||
+            submeshes[s].material < 0 || submeshes[s].material >= nmaterials) return false;
+    for (uint32_t m = 0; m < header.nmeshlets; m++)
+        if (!range_inside(meshlets[m].first_face, meshlets[m].nfaces)) return false;
+    return true;
+}
+
+const MeshCacheHeader *validate_mesh_cache(const std::byte *image, const size_t size, const MeshCacheSource &source, const uint32_t flags) {
+    if (!image || size < sizeof(MeshCacheHeader)) return nullptr;
+
+    const auto *header = reinterpret_cast<const MeshCacheHeader *>(image);
+    if (std::memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0 || header->version != MESH_CACHE_VERSION) return nullptr;
+    if (header->checksum != header_checksum(*header) || header->size != size) return nullptr;
+    if (header->flags != flags || header->source.size != source.size || header->source.mtime != source.mtime) return nullptr;
+
+    // Every section must lie inside the file, the variable-length tables being the last ones
+    const bool sections_inside = header->nindices % 3 == 0 &&
+                                 section_inside(header->vertices, header->nverts, sizeof(PackedVertex), size) &&
+                                 section_inside(header->indices, header->nindices, sizeof(int), size) &&
+                                 section_inside(header->face_materials, header->nindices / 3, sizeof(int), size) &&
+                                 section_inside(header->submeshes, header->nsubmeshes, sizeof(SubMesh), size) &&
+                                 section_inside(header->meshlets, header->nmeshlets, sizeof(Meshlet), size) &&
+                                 section_inside(header->materials, 0, 1, size) &&
+                                 section_inside(header->dependencies, 0, 1, size);
+    if (!sections_inside || !dependencies_unchanged(image, *header)) return nullptr;
+    if (header->payload_checksum != payload_checksum(image, size)) return nullptr;
+    return payload_in_bounds(image, *header) ? header : nullptr;
+}
+
+std::vector<std::array<std::string, 3>> mesh_cache_textures(const std::byte *image) {
+    const auto *header = reinterpret_cast<const MeshCacheHeader *>(image);
+    const std::byte *in = image + header->materials, *end = image + header->size;
+
+    std::vector<std::array<std::string, 3>> textures(header->nmaterials);
+    for (auto &paths: textures)
+        for (std::string &path: paths)
+            if (!read_string(in, end, path)) return textures;
+    return textures;
+}
+
+bool write_mesh_cache(const std::string &path, const std::vector<vec4f> &image) {
+    // Written under a temporary name unique to this writer and renamed, so a concurrent run neither
+    // maps a partial file nor writes into the same temporary
+    const std::string tmp = path + "." + std::to_string(std::random_device{}()) + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if (!out) return false;
+        out.write(reinterpret_cast<const char *>(image.data()), static_cast<std::streamsize>(image.size() * sizeof(vec4f)));
+        if (!out) return false;
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(tmp, path, ec);
+    if (!ec) return true;
+    std::filesystem::remove(tmp, ec);
+    return false;
+}
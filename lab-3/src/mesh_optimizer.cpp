@@ -0,0 +1,158 @@
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <cmath>
+
+std::vector<int> optimize_vertex_cache(const std::vector<int> &indices, const int nverts, const int cache_size) {
+    const int nfaces = static_cast<int>(indices.size() / 3);
+
+    // Vertex -> triangle adjacency
+    std::vector<int> live(nverts, 0);
+    for (const int v: indices)
+        live[v]++;
+    std::vector<int> offsets(nverts + 1, 0);
+    for (int v = 0; v < nverts; v++)
+        offsets[v + 1] = offsets[v] + live[v];
+    std::vector<int> adjacency(indices.size());
+    std::vector<int> fill(offsets.begin(), offsets.end() - 1);
+    for (int t = 0; t < nfaces; t++)
+        for (int k = 0; k < 3; k++)
+            adjacency[fill[indices[t * 3 + k]]++] = t;
+
+    std::vector<int>  cache_time(nverts, 0);
+    std::vector<bool> emitted(nfaces, false);
+    std::vector<int>  dead_end;
+    std::vector<int>  candidates;
+    std::vector<int>  result;
+    result.reserve(indices.size());
+
+    int fanning = nverts > 0 ? 0 : -1;
+    int cursor  = 1;
+    int time    = cache_size + 1;
+
+    while (fanning >= 0) {
+        // Emit every remaining triangle around the fanning vertex
+        candidates.clear();
+        for (int a = offsets[fanning]; a < offsets[fanning + 1]; a++) {
+            const int t = adjacency[a];
+            if (emitted[t]) continue;
+            emitted[t] = true;
+            for (int k = 0; k < 3; k++) {
+                const int v = indices[t * 3 + k];
+                result.push_back(v);
+                dead_end.push_back(v);
+                candidates.push_back(v);
+                live[v]--;
+                if (time - cache_time[v] > cache_size)
+                    cache_time[v] = time++;
+            }
+        }
+
+        // Next fanning vertex: the one that stays longest in the cache without being evicted
+        int best = -1, best_priority = -1;
+        for (const int v: candidates) {
+            if (live[v] <= 0) continue;
+            int priority = 0;
+            if (time - cache_time[v] + 2 * live[v] <= cache_size)
+                priority = time - cache_time[v];
+            if (priority > best_priority) {
+                best_priority = priority;
+                best = v;
+            }
+        }
+
+        // Dead end: back up through recently used vertices, then scan forward
+        while (best < 0 && !dead_end.empty()) {
+            const int v = dead_end.back();
+            dead_end.pop_back();
+            if (live[v] > 0) best = v;
+        }
+        while (best < 0 && cursor < nverts) {
+            if (live[cursor] > 0) best = cursor;
+            cursor++;
+        }
+        fanning = best;
+    }
+    return result;
+}
+
+std::vector<int> optimize_vertex_fetch_remap(const std::vector<int> &indices, const int nverts) {
+    std::vector<int> remap(nverts, -1);
+    int next = 0;
+    for (const int v: indices)
+        if (remap[v] < 0) remap[v] = next++;
+    for (int &r: remap)
+        if (r < 0) r = next++;
+    return remap;
+}
+
+static Meshlet meshlet_bounds(const std::vector<int> &indices, const std::vector<vec3f> &positions, const int first, const int n) {
+    Meshlet meshlet{first, n, {}, {}, 1.f};
+
+    // The box, then the smallest sphere around its center that holds every corner
+    Bounds &bounds = meshlet.bounds;
+    for (int i = first * 3; i < (first + n) * 3; i++)
+        bounds.box.expand(positions[indices[i]]);
+    bounds.sphere.center = (bounds.box.min + bounds.box.max) * .5f;
+    float radius2 = 0;
+    for (int i = first * 3; i < (first + n) * 3; i++) {
+        const vec3f d = positions[indices[i]] - bounds.sphere.center;
+        radius2 = std::max(radius2, d * d);
+    }
+    bounds.sphere.radius = std::sqrt(radius2);
+
+    // Normal cone around the mean face normal; degenerate faces cover no pixel and are ignored
+    std::vector<vec3f> normals;
+    normals.reserve(n);
+    vec3f sum = {};
+    for (int f = first; f < first + n; f++) {
+        const vec3f &a = positions[indices[f * 3]], &b = positions[indices[f * 3 + 1]], &c = positions[indices[f * 3 + 2]];
+        const vec3f normal = cross(b - a, c - a);
+        const float length = norm(normal);
+        if (length == 0) continue;
+        normals.push_back(normal / length);
+        sum = sum + normals.back();
+    }
+    const float length = norm(sum);
+    if (length == 0) return meshlet;
+    meshlet.cone_axis = sum / length;
+
+    float min_dot = 1;
+    for (const vec3f &normal: normals)
+        min_dot = std::min(min_dot, normal * meshlet.cone_axis);
+    // Past about 84 degrees the cone could only be culled from almost straight behind it
+    if (min_dot > .1f)
+        meshlet.cone_cutoff = std::sqrt(1 - min_dot * min_dot);
+    return meshlet;
+}
+
+std::vector<Meshlet> build_meshlets(const std::vector<int> &indices, const std::vector<vec3f> &positions,
+                                    const std::vector<SubMesh> &submeshes, const int max_vertices, const int max_faces) {
+    std::vector<Meshlet> meshlets;
+    std::vector<int> seen(positions.size(), -1); // meshlet a vertex was last counted in
+
+    for (const SubMesh &sub: submeshes) {
+        int first = sub.first_face, nverts = 0;
+        for (int f = sub.first_face; f < sub.first_face + sub.nfaces; f++) {
+            const int id = static_cast<int>(meshlets.size());
+            int added = 0;
+            for (int k = 0; k < 3; k++)
+                added += seen[indices[f * 3 + k]] != id;
+            if (f - first == max_faces || nverts + added > max_vertices) {
+                meshlets.push_back(meshlet_bounds(indices, positions, first, f - first));
+                first  = f;
+                nverts = 0;
+            }
+            for (int k = 0; k < 3; k++) {
+                int &mark = seen[indices[f * 3 + k]];
+                if (mark != static_cast<int>(meshlets.size())) {
+                    mark = static_cast<int>(meshlets.size());
+                    nverts++;
+                }
+            }
+        }
+        if (sub.nfaces > 0)
+            meshlets.push_back(meshlet_bounds(indices, positions, first, sub.first_face + sub.nfaces - first));
+    }
+    return meshlets;
+}
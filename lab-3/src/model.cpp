@@ -1,23 +1,30 @@
 #include "model.h"
 
+#include <assimp/DefaultIOSystem.h>
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 
+#include <algorithm>
+#include <array>
+#include <cmath>
 #include <iostream>
 
+#include "mesh_optimizer.h"
+
 static std::string parentDir(const std::string &path) {
     const size_t slash = path.find_last_of("/\\");
     if (slash == std::string::npos) return "";
     return path.substr(0, slash + 1);
 }
 
-static bool load_tga(const std::string &directory, const aiString &path, TGAImage &img) {
-    if (path.length == 0) return false;
+static bool load_tga(const std::string &directory, const std::string &path, Texture2D &texture) {
+    if (path.empty()) return false;
 
-    const std::string filepath = directory + std::string(path.C_Str());
+    const std::string filepath = directory + path;
 
-    if (img.read_tga_file(filepath)) {
+    if (TGAImage img; img.read_tga_file(filepath)) {
+        texture = Texture2D(img);
         return true;
     }
 
@@ -25,102 +32,267 @@ static bool load_tga(const std::string &directory, const aiString &path, TGAImag
     return false;
 }
 
-void Model::load_textures(const std::string &objPath, const aiMaterial *material) {
+static std::array<std::string, 3> texture_paths(const aiMaterial *material) {
+    std::array<std::string, 3> paths;
     aiString path;
-    const std::string dir = parentDir(objPath);
 
     // Diffuse map
     if (material->GetTexture(aiTextureType_DIFFUSE, 0, &path) == AI_SUCCESS)
-        load_tga(dir, path, diffuse_map);
+        paths[0] = path.C_Str();
 
     // Normal map
     if (material->GetTexture(aiTextureType_NORMALS, 0, &path) == AI_SUCCESS ||
         material->GetTexture(aiTextureType_HEIGHT, 0, &path) == AI_SUCCESS)
-        load_tga(dir, path, normal_map);
+        paths[1] = path.C_Str();
 
     // Specular map
     if (material->GetTexture(aiTextureType_SPECULAR, 0, &path) == AI_SUCCESS)
-        load_tga(dir, path, specular_map);
+        paths[2] = path.C_Str();
+
+    return paths;
+}
+
+static vec3f to_vec3f(const aiVector3D &v) {
+    return {v.x, v.y, v.z};
 }
 
-Model::Model(const std::string &filename) {
-    Assimp::Importer importer;
+static void load_node(const aiScene *scene, const aiNode *node, const aiMatrix4x4 &parent, MeshData &mesh) {
+    const aiMatrix4x4 transform = parent * node->mTransformation;
+    const aiMatrix3x3 linear(transform);
+    aiMatrix3x3 normal_matrix = linear;
+    normal_matrix.Inverse().Transpose();
+
+    for (unsigned m = 0; m < node->mNumMeshes; m++) {
+        const aiMesh *src = scene->mMeshes[node->mMeshes[m]];
+        // Points and lines, split into meshes of their own by aiProcess_SortByPType, are not drawn
+        if (!(src->mPrimitiveTypes & aiPrimitiveType_TRIANGLE)) continue;
+        const int base = static_cast<int>(mesh.vertices.size());
+
+        // Vertices, normals, tangents, texture coordinates
+        for (unsigned i = 0; i < src->mNumVertices; i++) {
+            PackedVertex &vertex = mesh.vertices.emplace_back();
+
+            const aiVector3D p = transform * src->mVertices[i];
+            vertex.position[0] = p.x;
+            vertex.position[1] = p.y;
+            vertex.position[2] = p.z;
 
+            const vec3f n = normalized(to_vec3f(normal_matrix * src->mNormals[i]));
+            vertex.normal = pack_normal(n);
+
+            if (src->mTangents && src->mBitangents) {
+                const vec3f t = normalized(to_vec3f(linear * src->mTangents[i]));
+                const vec3f b = to_vec3f(linear * src->mBitangents[i]);
+                vertex.tangent = pack_tangent({t.x, t.y, t.z, cross(n, t) * b < 0 ? -1.f : 1.f});
+            } else {
+                vertex.tangent = pack_tangent({1, 0, 0, 1});
+            }
+
+            const aiVector3D uv = src->mTextureCoords[0] ? src->mTextureCoords[0][i] : aiVector3D{0, 1, 0};
+            vertex.uv[0] = float_to_half(uv.x);
+            vertex.uv[1] = float_to_half(1.f - uv.y);
+        }
+
+        // Faces; anything but a triangle would shift every later face in the index buffer
+        const int material   = std::min(static_cast<int>(src->mMaterialIndex), static_cast<int>(mesh.textures.size()) - 1);
+        const int first_face = static_cast<int>(mesh.face_materials.size());
+        for (unsigned i = 0; i < src->mNumFaces; i++) {
+            const aiFace &f = src->mFaces[i];
+            if (f.mNumIndices != 3) continue;
+            for (unsigned k = 0; k < 3; k++)
+                mesh.indices.push_back(base + static_cast<int>(f.mIndices[k]));
+            mesh.face_materials.push_back(material);
+        }
+        mesh.submeshes.push_back({first_face, static_cast<int>(mesh.face_materials.size()) - first_face, material});
+    }
+
+    for (unsigned c = 0; c < node->mNumChildren; c++)
+        load_node(scene, node->mChildren[c], transform, mesh);
+}
+
+static void optimize_layout(MeshData &mesh) {
+    const int n = static_cast<int>(mesh.vertices.size());
+
+    // Triangles are reordered within their submesh only, so draw ranges and materials stay valid.
+    // A submesh references only the vertices appended with it, so it is optimized in local indices.
+    for (const SubMesh &sub: mesh.submeshes) {
+        if (sub.nfaces == 0) continue;
+        const auto first = mesh.indices.begin() + sub.first_face * 3, last = first + sub.nfaces * 3;
+        const int base  = *std::min_element(first, last);
+        const int count = *std::max_element(first, last) - base + 1;
+
+        std::vector<int> local(first, last);
+        for (int &idx: local) idx -= base;
+        local = optimize_vertex_cache(local, count);
+        for (int &idx: local) idx += base;
+        std::copy(local.begin(), local.end(), first);
+    }
+
+    const std::vector<int> remap = optimize_vertex_fetch_remap(mesh.indices, n);
+    std::vector<PackedVertex> vertices(n);
+    for (int i = 0; i < n; i++)
+        vertices[remap[i]] = mesh.vertices[i];
+    mesh.vertices = std::move(vertices);
+
+    for (int &idx: mesh.indices)
+        idx = remap[idx];
+}
+
+// Records every file the importer opens, or fails to open, besides the source itself: the mesh
+// cache is only current while all of them are unchanged
+class RecordingIOSystem : public Assimp::DefaultIOSystem {
+public:
+    RecordingIOSystem(const std::string &source, std::vector<MeshCacheDependency> &opened)
+        : source_(mesh_cache_dependency(source).path), opened_(opened) {}
+
+    Assimp::IOStream *Open(const char *file, const char *mode) override {
+        MeshCacheDependency dependency = mesh_cache_dependency(file);
+        const bool seen = dependency.path == source_ ||
+            std::any_of(opened_.begin(), opened_.end(), [&](const MeshCacheDependency &d) { return d.path == dependency.path; });
+        if (!seen) opened_.push_back(std::move(dependency));
+        return DefaultIOSystem::Open(file, mode);
+    }
+
+private:
+    std::string                       source_;
+    std::vector<MeshCacheDependency> &opened_;
+};
+
+static bool import_mesh(Assimp::Importer &importer, const std::string &filename, MeshData &mesh) {
+    // The importer only borrows the handler: passing nullptr hands it back before it goes out of scope
+    RecordingIOSystem io(filename, mesh.dependencies);
+    importer.SetIOHandler(&io);
     const aiScene *scene = importer.ReadFile(
         filename,
         aiProcess_Triangulate |
+        aiProcess_SortByPType |
         aiProcess_GenNormals |
         aiProcess_CalcTangentSpace |
         aiProcess_JoinIdenticalVertices
     );
+    importer.SetIOHandler(nullptr);
 
     if (!scene || !scene->mRootNode || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE) {
         std::cerr << "Assimp error: " << importer.GetErrorString() << std::endl;
-        return;
+        return false;
     }
 
-    const aiMesh *mesh = scene->mMeshes[0];
+    // Materials; a scene without any still gets a default one
+    mesh.textures.resize(std::max(1u, scene->mNumMaterials));
+    for (unsigned i = 0; i < scene->mNumMaterials; i++)
+        mesh.textures[i] = texture_paths(scene->mMaterials[i]);
 
-    // Allocate memory
-    vertices.reserve(mesh->mNumVertices);
-    normals.reserve(mesh->mNumVertices);
-    uvs.reserve(mesh->mNumVertices);
+    // Allocate memory for one instance of every mesh
+    unsigned nverts_total = 0, nfaces_total = 0;
+    for (unsigned m = 0; m < scene->mNumMeshes; m++) {
+        nverts_total += scene->mMeshes[m]->mNumVertices;
+        nfaces_total += scene->mMeshes[m]->mNumFaces;
+    }
+    mesh.vertices.reserve(nverts_total);
+    mesh.indices.reserve(nfaces_total * 3);
+    mesh.face_materials.reserve(nfaces_total);
 
-    // Vertices, normals, texture coordinates
-    for (unsigned i = 0; i < mesh->mNumVertices; i++) {
-        const aiVector3D v = mesh->mVertices[i];
-        vertices.push_back(vec4{v.x, v.y, v.z, 1.0f});
+    load_node(scene, scene->mRootNode, aiMatrix4x4(), mesh);
+    importer.FreeScene();
+    return true;
+}
 
-        const aiVector3D n = mesh->mNormals[i];
-        normals.push_back(normalized(vec4{n.x, n.y, n.z}));
+void Model::use_image(const std::byte *image, const std::string &filename) {
+    const auto &header = *reinterpret_cast<const MeshCacheHeader *>(image);
+    const uint32_t nfaces = header.nindices / 3;
 
-        if (mesh->mTextureCoords[0]) {
-            const aiVector3D uv = mesh->mTextureCoords[0][i];
-            uvs.push_back({uv.x, 1.f - uv.y});
-        } else {
-            uvs.push_back({0, 0});
-        }
+    vertices       = {reinterpret_cast<const PackedVertex *>(image + header.vertices), header.nverts};
+    facet_vrt      = {reinterpret_cast<const int *>(image + header.indices), header.nindices};
+    facet_mat      = {reinterpret_cast<const int *>(image + header.face_materials), nfaces};
+    submesh_ranges = {reinterpret_cast<const SubMesh *>(image + header.submeshes), header.nsubmeshes};
+    meshlet_list   = {reinterpret_cast<const Meshlet *>(image + header.meshlets), header.nmeshlets};
+
+    compute_bounds();
+
+    // Textures
+    const std::string dir = parentDir(filename);
+    const auto textures = mesh_cache_textures(image);
+    material_list.resize(textures.size());
+    for (size_t i = 0; i < textures.size(); i++) {
+        load_tga(dir, textures[i][0], material_list[i].diffuse_map);
+        load_tga(dir, textures[i][1], material_list[i].normal_map);
+        load_tga(dir, textures[i][2], material_list[i].specular_map);
     }
+}
 
-    // Faces
-    for (unsigned i = 0; i < mesh->mNumFaces; i++) {
-        const aiFace &f = mesh->mFaces[i];
-        for (unsigned k = 0; k < 3; k++) {
-            int idx = static_cast<int>(f.mIndices[k]);
-            facet_vrt.push_back(idx);
-            facet_nrm.push_back(idx);
-            facet_tex.push_back(idx);
-        }
+void Model::compute_bounds() {
+    // Enclosing the meshlets keeps a mapped model from touching its vertices
+    model_bounds = {};
+    for (const Meshlet &meshlet: meshlet_list) {
+        model_bounds.box.expand(meshlet.bounds.box.min);
+        model_bounds.box.expand(meshlet.bounds.box.max);
     }
+    if (model_bounds.box.empty()) return;
 
-    // Textures
-    if (scene->mNumMaterials > 0) {
-        load_textures(filename, scene->mMaterials[mesh->mMaterialIndex]);
+    model_bounds.sphere.center = (model_bounds.box.min + model_bounds.box.max) * .5f;
+    for (const Meshlet &meshlet: meshlet_list)
+        model_bounds.sphere.radius = std::max(model_bounds.sphere.radius,
+            norm(meshlet.bounds.sphere.center - model_bounds.sphere.center) + meshlet.bounds.sphere.radius);
+}
+
+Model::Model(Assimp::Importer &importer, const std::string &filename, const bool optimize) {
+    const uint32_t flags = optimize ? MESH_CACHE_OPTIMIZED : 0;
+    const std::string cache_path = filename + ".trmesh";
+
+    MeshCacheSource source{};
+    if (!mesh_cache_source(filename, source)) {
+        std::cerr << "Cannot read model: " << filename << std::endl;
+        return;
+    }
+
+    // Current cache: used in place, without parsing or copying
+    if (cache_file.open(cache_path) && validate_mesh_cache(cache_file.data(), cache_file.size(), source, flags)) {
+        from_cache = true;
+        use_image(cache_file.data(), filename);
+        std::cout << "Loaded model: " << cache_path << " (" << debug_info() << ")" << std::endl;
+        return;
     }
+    cache_file.close();
+
+    MeshData mesh;
+    if (!import_mesh(importer, filename, mesh))
+        return;
+
+    if (optimize)
+        optimize_layout(mesh);
+
+    std::vector<vec3f> positions(mesh.vertices.size());
+    for (size_t i = 0; i < positions.size(); i++)
+        positions[i] = {mesh.vertices[i].position[0], mesh.vertices[i].position[1], mesh.vertices[i].position[2]};
+    mesh.meshlets = build_meshlets(mesh.indices, positions, mesh.submeshes);
+
+    cache_image = build_mesh_cache(mesh, source, flags);
+    if (!write_mesh_cache(cache_path, cache_image))
+        std::cerr << "Failed to write mesh cache: " << cache_path << std::endl;
+    use_image(reinterpret_cast<const std::byte *>(cache_image.data()), filename);
 
     std::cout << "Loaded model: " << filename << " (" << debug_info() << ")" << std::endl;
 }
 
-vec4 Model::normal(const vec2 &uv) const {
-    if (normal_map.width() == 0 || normal_map.height() == 0)
-        return vec4{0, 0, 1, 0 };
+vec4f Material::normal(const Sampler &sampler, const vec2f &uv, const vec2f &duv_dx, const vec2f &duv_dy) const {
+    if (normal_map.empty())
+        return vec4f{0, 0, 1, 0 };
 
-    TGAColor c = normal_map.get(uv.x * normal_map.width(), uv.y * normal_map.height());
-    return normalized(vec4{
-        static_cast<double>(c[2]) * 2.0 / 255.0 - 1.0,
-        static_cast<double>(c[1]) * 2.0 / 255.0 - 1.0,
-        static_cast<double>(c[0]) * 2.0 / 255.0 - 1.0,
+    const vec4f c = normal_map.sample(sampler, uv, duv_dx, duv_dy);
+    return normalized(vec4f{
+        c.x * 2.0f - 1.0f,
+        c.y * 2.0f - 1.0f,
+        c.z * 2.0f - 1.0f,
         0.0f
     });
 }
 
 std::string Model::debug_info() const {
     std::string str = "vertices: " + std::to_string(vertices.size()) +
-                      ", normals: " + std::to_string(normals.size()) +
-                      ", uvs: " + std::to_string(uvs.size()) +
                       ", faces: " + std::to_string(nfaces()) +
-                      ", diffuse map: " + (diffuse_map.width() > 0 ? "yes" : "no") +
-                      ", normal map: " + (normal_map.width() > 0 ? "yes" : "no") +
-                      ", specular map: " + (specular_map.width() > 0 ? "yes" : "no");
+                      ", submeshes: " + std::to_string(submesh_ranges.size()) +
+                      ", meshlets: " + std::to_string(meshlet_list.size()) +
+                      ", materials: " + std::to_string(material_list.size()) +
+                      (from_cache ? ", cached" : "");
     return str;
 }
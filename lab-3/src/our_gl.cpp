@@ -1,44 +1,321 @@
 #include <algorithm>
+#include <cfloat>
+#include <cmath>
 
 #include "camera.h"
 #include "our_gl.h"
 
 TGAImage Gl_Globals::FRAME_BUFFER;
-std::vector<double> Gl_Globals::Z_BUFFER;
+HdrImage Gl_Globals::HDR_BUFFER;
+DepthBuffer Gl_Globals::Z_BUFFER;
 
-void Gl_Globals::init(const int width, const int height, const TGAColor clear_color) {
+DepthBuffer::DepthBuffer(const int width, const int height)
+    : width(width), height(height), z(width * height, Gl_Globals::CLEAR_DEPTH),
+      hi_z_width((width + Gl_Globals::HI_Z_BLOCK - 1) / Gl_Globals::HI_Z_BLOCK) {
+    hi_z.assign(hi_z_width * ((height + Gl_Globals::HI_Z_BLOCK - 1) / Gl_Globals::HI_Z_BLOCK), Gl_Globals::CLEAR_DEPTH);
+}
+
+void DepthBuffer::clear() {
+    std::fill(z.begin(), z.end(), Gl_Globals::CLEAR_DEPTH);
+    std::fill(hi_z.begin(), hi_z.end(), Gl_Globals::CLEAR_DEPTH);
+}
+
+void Gl_Globals::init(const int width, const int height, const TGAColor clear_color, const bool hdr) {
     FRAME_BUFFER = TGAImage(width, height, TGAImage::RGB, clear_color);
-    Z_BUFFER = std::vector(width * height, -1000.);
+    HDR_BUFFER = hdr ? HdrImage(width, height, from_unorm8(clear_color)) : HdrImage();
+    Z_BUFFER = DepthBuffer(width, height);
+}
+
+void Gl_Globals::clear(const TGAColor clear_color) {
+    FRAME_BUFFER.clear(clear_color);
+    if (!HDR_BUFFER.empty()) HDR_BUFFER.clear(from_unorm8(clear_color));
+    Z_BUFFER.clear();
+}
+
+bool hi_z_occluded(const BinnedTriangle &tri, const DepthBuffer &depth, const int x0, const int y0, const int x1, const int y1) {
+    for (int by = y0 / Gl_Globals::HI_Z_BLOCK; by <= y1 / Gl_Globals::HI_Z_BLOCK; by++)
+        for (int bx = x0 / Gl_Globals::HI_Z_BLOCK; bx <= x1 / Gl_Globals::HI_Z_BLOCK; bx++)
+            if (tri.zmax > depth.hi_z[bx + by * depth.hi_z_width]) return false;
+    return true;
+}
+
+void hi_z_update(const BinnedTriangle &tri, DepthBuffer &depth, const int x0, const int y0, const int x1, const int y1) {
+    constexpr int B = Gl_Globals::HI_Z_BLOCK;
+    const int width = depth.width, height = depth.height;
+
+    for (int by = y0 / B; by <= y1 / B; by++) {
+        for (int bx = x0 / B; bx <= x1 / B; bx++) {
+            // The triangle is convex, so it covers the block if it strictly contains the corner pixels
+            const double cx[2] = {static_cast<double>(bx * B), static_cast<double>(std::min(bx * B + B, width) - 1)};
+            const double cy[2] = {static_cast<double>(by * B), static_cast<double>(std::min(by * B + B, height) - 1)};
+            double zmin = tri.zmax;
+            bool covered = true;
+            for (int c = 0; c < 4 && covered; c++) {
+                const vec3 bc = tri.bc * vec3{cx[c & 1], cy[c >> 1], 1.};
+                covered = bc.x > tri.bc_eps.x && bc.y > tri.bc_eps.y && bc.z > tri.bc_eps.z;
+                zmin = std::min(zmin, bc * tri.depth);
+            }
+            if (!covered) continue;
+
+            // Depth is affine, so its minimum over the block is at a corner; every pixel now holds at
+            // least that (less the rounding of the stepped depth)
+            double &hi_z = depth.hi_z[bx + by * depth.hi_z_width];
+            hi_z = std::max(hi_z, zmin - 1e-9 * (1. + std::abs(zmin)));
+        }
+    }
+}
+
+
+TileRasterizer::TileRasterizer(const int width, const int height, const mat4 &viewport)
+    : width_(width), height_(height),
+      tiles_x_((width + TILE_SIZE - 1) / TILE_SIZE), tiles_y_((height + TILE_SIZE - 1) / TILE_SIZE),
+      viewport_(viewport), bins_(tiles_x_ * tiles_y_) {}
+
+Frustum TileRasterizer::frustum(const mat4 &clip_from_object) const {
+    // Ndc window of the pixels, one pixel wider on each side than what bin() can reach
+    const vec2 ndc_min = {(-1. - viewport_[0][3]) / viewport_[0][0], (-1. - viewport_[1][3]) / viewport_[1][1]};
+    const vec2 ndc_max = {(width_ - viewport_[0][3]) / viewport_[0][0], (height_ - viewport_[1][3]) / viewport_[1][1]};
+    return {clip_from_object, ndc_min, ndc_max, NEAR_W};
+}
+
+bool TileRasterizer::cull_meshlets(const DrawBounds &bounds, const int nverts, const ArrayView<int> indices) {
+    const Frustum view = frustum(bounds.clip_from_object);
+    if (view.culled(bounds.bounds)) {
+        stats_.draws_culled++;
+        stats_.faces_in_culled += static_cast<long long>(indices.size() / 3);
+        return false;
+    }
+
+    bool culled = false;
+    for (const Meshlet &meshlet: bounds.meshlets) {
+        stats_.meshlets++;
+        const bool outside = view.culled(meshlet.bounds);
+        if (outside || (cull_backfaces_ && view.backfacing(meshlet))) {
+            (outside ? stats_.meshlets_outside : stats_.meshlets_backfacing)++;
+            stats_.faces_in_culled += meshlet.nfaces;
+            culled = true;
+        } else if (!visible_.empty() && visible_.back().first_face + visible_.back().nfaces == meshlet.first_face) {
+            visible_.back().nfaces += meshlet.nfaces;
+        } else {
+            visible_.push_back({meshlet.first_face, meshlet.nfaces});
+        }
+    }
+    if (visible_.empty()) return false;
+
+    if (culled) {
+        live_.assign(nverts, 0);
+        for (const FaceRange &range: visible_)
+            for (int i = range.first_face * 3; i < (range.first_face + range.nfaces) * 3; i++)
+                live_[indices[i]] = 1;
+    }
+    return true;
+}
+
+void TileRasterizer::clear_bins(const DepthBuffer &depth) {
+    triangles_.clear();
+    remaps_.clear();
+    for (std::vector<int> &bin: bins_)
+        bin.clear();
+
+    // Coarse per-tile bound for rejecting triangles while binning; tiles only get nearer during the draw
+    tile_hi_z_.assign(bins_.size(), Gl_Globals::CLEAR_DEPTH);
+    for (int tile = 0; tile < static_cast<int>(bins_.size()); tile++) {
+        const int bx0 = tile % tiles_x_ * TILE_SIZE / Gl_Globals::HI_Z_BLOCK;
+        const int by0 = tile / tiles_x_ * TILE_SIZE / Gl_Globals::HI_Z_BLOCK;
+        const int bx1 = (std::min((tile % tiles_x_ + 1) * TILE_SIZE, width_) - 1) / Gl_Globals::HI_Z_BLOCK;
+        const int by1 = (std::min((tile / tiles_x_ + 1) * TILE_SIZE, height_) - 1) / Gl_Globals::HI_Z_BLOCK;
+        double hi_z = depth.hi_z.empty() ? Gl_Globals::CLEAR_DEPTH : depth.hi_z[bx0 + by0 * depth.hi_z_width];
+        for (int by = by0; by <= by1 && !depth.hi_z.empty(); by++)
+            for (int bx = bx0; bx <= bx1; bx++)
+                hi_z = std::min(hi_z, depth.hi_z[bx + by * depth.hi_z_width]);
+        tile_hi_z_[tile] = hi_z;
+    }
+}
+
+namespace {
+// Clip-space vertex of a clipped polygon, with its barycentric coordinates in the original triangle
+struct ClipVertex {
+    vec4 pos;
+    vec3 bar;
+};
+
+enum Outcode { NEAR = 1, LEFT = 2, RIGHT = 4, BOTTOM = 8, TOP = 16 };
+
+int outcode(const vec4 &v) {
+    const double g = TileRasterizer::GUARD_BAND * v.w;
+    return (v.w < TileRasterizer::NEAR_W ? NEAR : 0) |
+           (v.x < -g ? LEFT : 0) | (v.x > g ? RIGHT : 0) |
+           (v.y < -g ? BOTTOM : 0) | (v.y > g ? TOP : 0);
+}
+
+// Signed distance to a clip plane, non-negative inside
+double distance(const vec4 &v, const Outcode plane) {
+    const double g = TileRasterizer::GUARD_BAND * v.w;
+    switch (plane) {
+        case NEAR:   return v.w - TileRasterizer::NEAR_W;
+        case LEFT:   return v.x + g;
+        case RIGHT:  return g - v.x;
+        case BOTTOM: return v.y + g;
+        case TOP:    return g - v.y;
+    }
+    return 0;
+}
+
+// Sutherland-Hodgman against one plane; a convex polygon gains at most one vertex per plane
+int clip_polygon(const ClipVertex *in, const int n, ClipVertex *out, const Outcode plane) {
+    int m = 0;
+    for (int i = 0; i < n; i++) {
+        const ClipVertex &a = in[i], &b = in[(i + 1) % n];
+        const double da = distance(a.pos, plane), db = distance(b.pos, plane);
+        if (da >= 0) out[m++] = a;
+        if ((da >= 0) != (db >= 0)) {
+            const double t = da / (da - db);
+            out[m++] = {a.pos + (b.pos - a.pos) * t, a.bar + (b.bar - a.bar) * t};
+        }
+    }
+    return m;
+}
+}
+
+int TileRasterizer::split_chunks() {
+    int nchunks = 0;
+    for (const FaceRange &range: visible_) {
+        for (int f = range.first_face; f < range.first_face + range.nfaces; f += ASSEMBLY_CHUNK) {
+            if (nchunks == static_cast<int>(chunks_.size())) chunks_.emplace_back();
+            BinChunk &chunk = chunks_[nchunks++];
+            chunk.faces = {f, std::min(ASSEMBLY_CHUNK, range.first_face + range.nfaces - f)};
+            chunk.triangles.clear();
+            chunk.remaps.clear();
+            chunk.entries.clear();
+            chunk.stats = {};
+        }
+    }
+    return nchunks;
+}
+
+void TileRasterizer::merge_chunks(const int nchunks) {
+    for (int c = 0; c < nchunks; c++) {
+        const BinChunk &chunk = chunks_[c];
+        const int first = static_cast<int>(triangles_.size()), first_remap = static_cast<int>(remaps_.size());
+        for (BinnedTriangle tri: chunk.triangles) {
+            if (tri.remap >= 0) tri.remap += first_remap;
+            triangles_.push_back(tri);
+        }
+        remaps_.insert(remaps_.end(), chunk.remaps.begin(), chunk.remaps.end());
+        for (const auto &[tile, index]: chunk.entries)
+            bins_[tile].push_back(first + index);
+
+        stats_.faces_backfacing += chunk.stats.faces_backfacing;
+        stats_.faces_outside    += chunk.stats.faces_outside;
+        stats_.faces_binned     += chunk.stats.faces_binned;
+    }
 }
 
+bool TileRasterizer::clip_and_bin(const Triangle &clip, const int face, BinChunk &chunk) const {
+    // det[x y w] of the corners is the screen-space area times w0 w1 w2, and with w affine in eye
+    // space it is the eye-space facing even for triangles crossing w = 0: back faces go before setup
+    const mat<3, 3> xyw = {{clip[0].x, clip[0].y, clip[0].w}, {clip[1].x, clip[1].y, clip[1].w}, {clip[2].x, clip[2].y, clip[2].w}};
+    const bool back = xyw.det() <= 0;
+    if (back && cull_backfaces_) {
+        chunk.stats.faces_backfacing++;
+        return false;
+    }
+    // Double-sided: a back face is binned with its last two corners swapped, remapped back to the face
+    const int second = back ? 2 : 1, third = back ? 1 : 2;
+    const vec3 corner_bar[3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+
+    const int codes[3] = {outcode(clip[0]), outcode(clip[1]), outcode(clip[2])};
+    if (codes[0] & codes[1] & codes[2]) {
+        chunk.stats.faces_outside++;
+        return false;
+    }
+    const int crossed = codes[0] | codes[1] | codes[2];
+    if (!crossed && !back) {
+        const bool binned = bin(clip, face, -1, chunk);
+        chunk.stats.faces_binned += binned;
+        return binned;
+    }
+
+    // Up to 3 + one vertex per plane
+    ClipVertex polygon[2][8] = {{{clip[0], corner_bar[0]}, {clip[second], corner_bar[second]}, {clip[third], corner_bar[third]}}};
+    int n = 3, current = 0;
+    for (const Outcode plane: {NEAR, LEFT, RIGHT, BOTTOM, TOP}) {
+        if (!(crossed & plane)) continue;
+        n = clip_polygon(polygon[current], n, polygon[1 - current], plane);
+        current = 1 - current;
+        if (n < 3) {
+            chunk.stats.faces_outside++;
+            return false;
+        }
+    }
+
+    // Fan-triangulate; each piece remembers how its barycentrics map back to the face
+    bool binned = false;
+    const ClipVertex *p = polygon[current];
+    for (int i = 1; i + 1 < n; i++) {
+        const Triangle piece = {p[0].pos, p[i].pos, p[i + 1].pos};
+        chunk.remaps.push_back({p[0].bar, p[i].bar, p[i + 1].bar});
+        if (bin(piece, face, static_cast<int>(chunk.remaps.size()) - 1, chunk))
+            binned = true;
+        else
+            chunk.remaps.pop_back();
+    }
+    chunk.stats.faces_binned += binned;
+    return binned;
+}
 
-void rasterize(const Triangle &clip, const IShader &shader, TGAImage &framebuffer, const mat4 &viewport) {
+bool TileRasterizer::bin(const Triangle &clip, const int face, const int remap, BinChunk &chunk) const {
     const vec4 ndc[3] = {clip[0] / clip[0].w, clip[1] / clip[1].w, clip[2] / clip[2].w};
-    vec2 screen[3] = {(viewport * ndc[0]).xy(), (viewport * ndc[1]).xy(), (viewport * ndc[2]).xy()};
+    const vec2 screen[3] = {(viewport_ * ndc[0]).xy(), (viewport_ * ndc[1]).xy(), (viewport_ * ndc[2]).xy()};
 
     const mat<3, 3> ABC = {{{screen[0].x, screen[0].y, 1.}, {screen[1].x, screen[1].y, 1.}, {screen[2].x, screen[2].y, 1.0f}}};
-    if (ABC.det() < 1) return;
+    if (ABC.det() < 1) return false;
 
     auto [bbminx,bbmaxx] = std::minmax({screen[0].x, screen[1].x, screen[2].x});
     auto [bbminy,bbmaxy] = std::minmax({screen[0].y, screen[1].y, screen[2].y});
 
-    #pragma omp parallel for
-    for (int x = std::max<int>(bbminx, 0); x <= std::min<int>(bbmaxx, framebuffer.width() - 1); x++) {
-        for (int y = std::max<int>(bbminy, 0); y <= std::min<int>(bbmaxy, framebuffer.height() - 1); y++) {
-            vec3 bc_screen = ABC.invert_transpose() * vec3{static_cast<double>(x), static_cast<double>(y), 1.};
+    const int minx = std::max<int>(bbminx, 0), maxx = std::min<int>(bbmaxx, width_ - 1);
+    const int miny = std::max<int>(bbminy, 0), maxy = std::min<int>(bbmaxy, height_ - 1);
+    if (minx > maxx || miny > maxy) return false;
 
-            vec3 bc_clip = {bc_screen.x / clip[0].w, bc_screen.y / clip[1].w, bc_screen.z / clip[2].w};
+    const mat<3, 3> bc = ABC.invert_transpose();
+    const vec3 bc_dx = {bc[0][0], bc[1][0], bc[2][0]};
 
-            bc_clip = bc_clip / (bc_clip.x + bc_clip.y + bc_clip.z);
-            if (bc_screen.x < 0 || bc_screen.y < 0 || bc_screen.z < 0) continue;
+    // Bound on |stepped - exact| after at most TILE_SIZE steps, including the rounding of the exact expression itself
+    vec3 bc_eps;
+    for (int i = 0; i < 3; i++)
+        bc_eps[i] = (TILE_SIZE + 4) * DBL_EPSILON *
+                    (std::abs(bc[i][0]) * width_ + std::abs(bc[i][1]) * height_ + std::abs(bc[i][2]));
+    const vec3 w     = {clip[0].w, clip[1].w, clip[2].w};
+    const vec3 depth = {ndc[0].z, ndc[1].z, ndc[2].z};
+    const double zmax = std::max({depth.x, depth.y, depth.z});
 
-            double z = bc_screen * vec3{ndc[0].z, ndc[1].z, ndc[2].z};
-            if (z <= Gl_Globals::Z_BUFFER[x + y * framebuffer.width()]) continue;
+    // Tile-triangle pairs already hidden by earlier draws are never binned
+    bool visible = false;
+    for (int ty = miny / TILE_SIZE; ty <= maxy / TILE_SIZE && !visible; ty++)
+        for (int tx = minx / TILE_SIZE; tx <= maxx / TILE_SIZE && !visible; tx++)
+            visible = zmax > tile_hi_z_[tx + ty * tiles_x_];
+    if (!visible) return false;
 
-            auto [discard, color] = shader.fragment(bc_clip);
-            if (discard) continue;
-            Gl_Globals::Z_BUFFER[x + y * framebuffer.width()] = z;
-            framebuffer.set(x, y, color);
-        }
-    }
+    const int index = static_cast<int>(chunk.triangles.size());
+    chunk.triangles.push_back({
+        bc,
+        bc_dx,
+        bc_eps,
+        w,
+        {bc_dx.x / w.x, bc_dx.y / w.y, bc_dx.z / w.z},
+        {bc[0][1] / w.x, bc[1][1] / w.y, bc[2][1] / w.z},
+        depth,
+        bc_dx * depth,
+        zmax,
+        minx, miny, maxx, maxy,
+        face,
+        remap
+    });
+
+    for (int ty = miny / TILE_SIZE; ty <= maxy / TILE_SIZE; ty++)
+        for (int tx = minx / TILE_SIZE; tx <= maxx / TILE_SIZE; tx++)
+            if (zmax > tile_hi_z_[tx + ty * tiles_x_])
+                chunk.entries.emplace_back(tx + ty * tiles_x_, index);
+    return true;
 }
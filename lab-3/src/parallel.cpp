@@ -0,0 +1,109 @@
+#include "parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+unsigned worker_count() {
+    static const unsigned count = std::max(1u, std::thread::hardware_concurrency());
+    return count;
+}
+
+namespace {
+// One parallel_for call: its indices are claimed one at a time by whichever threads work on it
+struct Job {
+    const std::function<void(int)> &task;
+    const int        count;
+    std::atomic<int> next{0};
+    int              active = 0; // pool threads working on it, guarded by the pool mutex
+};
+
+// worker_count() - 1 threads, started on first use, that take jobs from one shared queue. A job
+// stays queued until its indices are all claimed, so every idle worker joins in.
+class WorkerPool {
+public:
+    WorkerPool() {
+        for (unsigned t = 1; t < worker_count(); t++)
+            threads_.emplace_back([this] { work(); });
+    }
+
+    ~WorkerPool() {
+        {
+            std::lock_guard lock(mutex_);
+            stopping_ = true;
+        }
+        job_ready_.notify_all();
+        for (std::thread &t: threads_)
+            t.join();
+    }
+
+    // Returns once every index of the job has run; the calling thread works on it too. Tasks may
+    // call parallel_for themselves: a waiting thread only waits for indices already being run.
+    void run(Job &job) {
+        {
+            std::lock_guard lock(mutex_);
+            jobs_.push_back(&job);
+        }
+        job_ready_.notify_all();
+
+        drain(job);
+
+        std::unique_lock lock(mutex_);
+        retire(job);
+        job_done_.wait(lock, [&] { return job.active == 0; });
+    }
+
+private:
+    static void drain(Job &job) {
+        for (int i = job.next++; i < job.count; i = job.next++)
+            job.task(i);
+    }
+
+    // Every index is claimed: no thread picks the job up any more (called with the mutex held)
+    void retire(const Job &job) {
+        const auto it = std::find(jobs_.begin(), jobs_.end(), &job);
+        if (it != jobs_.end()) jobs_.erase(it);
+    }
+
+    void work() {
+        std::unique_lock lock(mutex_);
+        for (;;) {
+            job_ready_.wait(lock, [&] { return stopping_ || !jobs_.empty(); });
+            if (stopping_) return;
+
+            Job &job = *jobs_.front();
+            job.active++;
+            lock.unlock();
+            drain(job);
+            lock.lock();
+
+            retire(job);
+            if (--job.active == 0) job_done_.notify_all();
+        }
+    }
+
+    std::mutex               mutex_;
+    std::condition_variable  job_ready_;
+    std::condition_variable  job_done_;
+    std::deque<Job *>        jobs_;
+    bool                     stopping_ = false;
+    std::vector<std::thread> threads_;
+};
+}
+
+void parallel_for(const int count, const std::function<void(int)> &task) {
+    if (count <= 0) return;
+    if (count == 1 || worker_count() == 1) {
+        for (int i = 0; i < count; i++)
+            task(i);
+        return;
+    }
+
+    static WorkerPool pool;
+    Job job{task, count};
+    pool.run(job);
+}
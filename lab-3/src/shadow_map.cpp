@@ -0,0 +1,66 @@
+#include "shadow_map.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "shaders/depth_shader.h"
+
+ShadowMap::ShadowMap(const int size, const int pcf_radius) : size_(size), pcf_radius_(std::max(0, pcf_radius)),
+    depth_(size, size), rasterizer_(size, size, mat4{}) {
+    rasterizer_.set_cull_backfaces(false);
+}
+
+void ShadowMap::fit(const vec3 &light, const Aabb &scene) {
+    const vec3   center   = vec_cast<double>((scene.min + scene.max) * .5f);
+    const double radius   = std::max(1e-6, .5 * norm(vec_cast<double>(scene.max - scene.min)));
+    const double distance = 4. * radius;
+    const vec3   dir      = normalized(light);
+    camera_.lookat(center + dir * distance, center, std::abs(dir.y) > .99 ? vec3{0, 0, 1} : vec3{0, 1, 0});
+    camera_.init_perspective(distance);
+
+    // The box lies in front of the light (w >= 1 - radius / distance), so its projection is the
+    // hull of its projected corners; lookat centres it on the view axis
+    const mat4 clip_from_world = camera_.perspective() * camera_.model_view();
+    double extent = 1e-6;
+    for (int c = 0; c < 8; c++) {
+        const vec4 corner = clip_from_world * vec4{c & 1 ? scene.max.x : scene.min.x, c & 2 ? scene.max.y : scene.min.y,
+                                                   c & 4 ? scene.max.z : scene.min.z, 1.};
+        extent = std::max({extent, std::abs(corner.x / corner.w), std::abs(corner.y / corner.w)});
+    }
+    const int scale = static_cast<int>((size_ - 1) / extent);
+    camera_.init_viewport((size_ - scale) / 2, (size_ - scale) / 2, scale, scale);
+
+    clip_from_world_ = clip_from_world;
+    map_from_world_  = camera_.viewport() * clip_from_world_;
+    rasterizer_.set_viewport(camera_.viewport());
+
+    // A texel spans 2 / scale in ndc, as many world units through the centre of the box (w = 1),
+    // where depth changes by 1 / w^2 = 1 per world unit along the light
+    texel_   = 2. / scale;
+    bias_    = .5 * texel_;
+    depth_.clear();
+}
+
+void ShadowMap::draw(const Model &model) {
+    DepthShader      shader(model, clip_from_world_);
+    const DrawBounds bounds = {clip_from_world_, model.bounds(), model.meshlets()};
+    rasterizer_.draw(shader, static_cast<int>(model.nverts()), model.indices(), depth_, &bounds);
+}
+
+float ShadowMap::visibility(const vec3f &world, const vec3f &normal) const {
+    // Normal offset: the lookup steps off the surface by a few texels, so a sloped surface does not
+    // shadow itself between the samples of the map
+    const vec3 p = vec_cast<double>(world) + vec_cast<double>(normal) * (3. * texel_);
+    const vec4 s = map_from_world_ * vec4{p.x, p.y, p.z, 1.};
+    if (s.w <= 0) return 1.f;
+    const double z  = s.z / s.w + bias_;
+    const int    cx = static_cast<int>(std::lround(s.x / s.w));
+    const int    cy = static_cast<int>(std::lround(s.y / s.w));
+
+    int lit = 0;
+    for (int y = cy - pcf_radius_; y <= cy + pcf_radius_; y++)
+        for (int x = cx - pcf_radius_; x <= cx + pcf_radius_; x++)
+            lit += x < 0 || y < 0 || x >= size_ || y >= size_ || z >= depth_.z[x + y * size_];
+    const int taps = (2 * pcf_radius_ + 1) * (2 * pcf_radius_ + 1);
+    return static_cast<float>(lit) / static_cast<float>(taps);
+}
@@ -0,0 +1,49 @@
+#include "shadow_mask.h"
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+
+#include "parallel.h"
+
+ShadowMask::ShadowMask(const int width, const int height) : width_(width), height_(height),
+    visibility_(static_cast<size_t>(width) * height, 1.f) {}
+
+void ShadowMask::trace(const Bvh &bvh, const mat4 &clip_from_world, const mat4 &viewport, const vec3 &light,
+                       const std::vector<double> &zbuffer, const double clear_depth, const float bias) {
+    const mat4  world_from_screen = (viewport * clip_from_world).invert();
+    const vec3f dir = vec_cast<float>(normalized(light));
+
+    std::atomic<long long> rays{0};
+    parallel_for((height_ + 1) / 2, [&](const int qy) {
+        long long row_rays = 0;
+        for (int qx = 0; qx < (width_ + 1) / 2; qx++) {
+            RayPacket packet;
+            packet.dir  = dir;
+            packet.tmin = bias;
+            int pixel[RAY_PACKET];
+            for (int k = 0; k < RAY_PACKET; k++) {
+                const int x = qx * 2 + (k & 1), y = qy * 2 + (k >> 1);
+                pixel[k] = x + y * width_;
+                packet.ox[k] = packet.oy[k] = packet.oz[k] = 0;
+                packet.tmax[k] = std::numeric_limits<float>::infinity();
+                if (x >= width_ || y >= height_ || zbuffer[pixel[k]] == clear_depth) continue;
+
+                const vec4 p = world_from_screen * vec4{static_cast<double>(x), static_cast<double>(y), zbuffer[pixel[k]], 1.};
+                packet.ox[k] = static_cast<float>(p.x / p.w);
+                packet.oy[k] = static_cast<float>(p.y / p.w);
+                packet.oz[k] = static_cast<float>(p.z / p.w);
+                packet.active |= 1u << k;
+            }
+            if (!packet.active) continue;
+
+            const unsigned blocked = bvh.occluded(packet);
+            for (int k = 0; k < RAY_PACKET; k++)
+                if (packet.active >> k & 1) visibility_[pixel[k]] = blocked >> k & 1 ? 0.f : 1.f;
+            for (unsigned lanes = packet.active; lanes; lanes &= lanes - 1)
+                row_rays++;
+        }
+        rays += row_rays;
+    });
+    rays_ = rays;
+}
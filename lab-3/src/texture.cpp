@@ -0,0 +1,60 @@
+#include "texture.h"
+
+#include <algorithm>
+#include <cmath>
+
+static std::uint32_t pack_rgba(const int r, const int g, const int b, const int a) {
+    return static_cast<std::uint32_t>(r) | static_cast<std::uint32_t>(g) << 8 |
+           static_cast<std::uint32_t>(b) << 16 | static_cast<std::uint32_t>(a) << 24;
+}
+
+Texture2D::Level::Level(const int width, const int height) : width(width), height(height),
+    tiles_x((width + TILE_SIZE - 1) >> TILE_SHIFT),
+    texels(static_cast<size_t>(tiles_x) * ((height + TILE_SIZE - 1) >> TILE_SHIFT) << (2 * TILE_SHIFT)) {}
+
+Texture2D::Texture2D(const TGAImage &image, const bool mipmaps) {
+    if (image.width() <= 0 || image.height() <= 0) return;
+
+    Level base(image.width(), image.height());
+    for (int y = 0; y < base.height; y++) {
+        for (int x = 0; x < base.width; x++) {
+            const TGAColor c = image.get(x, y);
+            base.texels[base.index(x, y)] = c.bytespp == TGAImage::GRAYSCALE
+                ? pack_rgba(c[0], c[0], c[0], 255)
+                : pack_rgba(c[2], c[1], c[0], c.bytespp == TGAImage::RGBA ? c[3] : 255);
+        }
+    }
+    levels_.push_back(std::move(base));
+
+    // Box-filtered pyramid down to 1x1; odd edges reuse their last row or column
+    while (mipmaps && (levels_.back().width > 1 || levels_.back().height > 1)) {
+        const Level &src = levels_.back();
+        Level dst(std::max(1, src.width / 2), std::max(1, src.height / 2));
+
+        for (int y = 0; y < dst.height; y++) {
+            const int y0 = std::min(2 * y, src.height - 1), y1 = std::min(2 * y + 1, src.height - 1);
+            for (int x = 0; x < dst.width; x++) {
+                const int x0 = std::min(2 * x, src.width - 1), x1 = std::min(2 * x + 1, src.width - 1);
+                const std::uint32_t t[4] = {
+                    src.texels[src.index(x0, y0)], src.texels[src.index(x1, y0)],
+                    src.texels[src.index(x0, y1)], src.texels[src.index(x1, y1)]
+                };
+                int sum[4] = {2, 2, 2, 2};
+                for (const std::uint32_t texel: t)
+                    for (int c = 0; c < 4; c++)
+                        sum[c] += static_cast<int>(texel >> (8 * c) & 0xffu);
+                dst.texels[dst.index(x, y)] = pack_rgba(sum[0] / 4, sum[1] / 4, sum[2] / 4, sum[3] / 4);
+            }
+        }
+        levels_.push_back(std::move(dst));
+    }
+}
+
+float Texture2D::lod(const vec2f &duv_dx, const vec2f &duv_dy) const {
+    if (empty()) return 0.f;
+    const auto w = static_cast<float>(levels_[0].width), h = static_cast<float>(levels_[0].height);
+    const vec2f dx = {duv_dx.x * w, duv_dx.y * h};
+    const vec2f dy = {duv_dy.x * w, duv_dy.y * h};
+    // log2 of the longer footprint axis, in texels
+    return 0.5f * std::log2(std::max(dx * dx, dy * dy));
+}
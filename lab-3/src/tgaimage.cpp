@@ -1,26 +1,35 @@
+#include <algorithm>
 #include <iostream>
 #include <cstring>
+#include "mapped_file.h"
 #include "tgaimage.h"
 
 TGAImage::TGAImage(const int w, const int h, const int bpp, TGAColor c) : w(w), h(h), bpp(bpp), data(w*h*bpp, 0) {
-    for (int j=0; j<h; j++)
-        for (int i=0; i<w; i++)
-            set(i, j, c);
+    clear(c);
+}
+
+void TGAImage::clear(const TGAColor c) {
+    if (data.empty()) return;
+    memcpy(data.data(), c.bgra, bpp);
+    for (size_t filled=bpp; filled<data.size(); filled*=2)
+        memcpy(data.data()+filled, data.data(), std::min(filled, data.size()-filled));
 }
 
 bool TGAImage::read_tga_file(const std::string &filename) {
-    std::ifstream in;
-    in.open(filename, std::ios::binary);
-    if (!in.is_open()) {
+    // The whole file is mapped and decoded from memory
+    MappedFile in;
+    if (!in.open(filename)) {
         std::cerr << "can't open file " << filename << "\n";
         return false;
     }
+    const std::uint8_t *file = reinterpret_cast<const std::uint8_t *>(in.data());
+    const size_t filesize = in.size();
     TGAHeader header;
-    in.read(reinterpret_cast<char *>(&header), sizeof(header));
-    if (!in.good()) {
+    if (filesize<sizeof(header)) {
         std::cerr << "an error occured while reading the header\n";
         return false;
     }
+    memcpy(&header, file, sizeof(header));
     w   = header.width;
     h   = header.height;
     bpp = header.bitsperpixel>>3;
@@ -28,16 +37,26 @@ bool TGAImage::read_tga_file(const std::string &filename) {
         std::cerr << "bad bpp (or width/height) value\n";
         return false;
     }
+    const size_t offset = sizeof(header) + header.idlength + header.colormaptype*header.colormaplength*((header.colormapdepth+7)>>3);
+    if (offset>filesize) {
+        std::cerr << "an error occured while reading the data\n";
+        return false;
+    }
     size_t nbytes = bpp*w*h;
     data = std::vector<std::uint8_t>(nbytes, 0);
     if (3==header.datatypecode || 2==header.datatypecode) {
-        in.read(reinterpret_cast<char *>(data.data()), nbytes);
-        if (!in.good()) {
+        if (filesize-offset<nbytes) {
             std::cerr << "an error occured while reading the data\n";
             return false;
         }
+        // Bottom-left origin rows are copied straight to their flipped position
+        const size_t rowbytes = w*bpp;
+        const bool bottom_up = !(header.imagedescriptor & 0x20);
+        for (int j=0; j<h; j++)
+            memcpy(data.data()+(bottom_up ? h-1-j : j)*rowbytes, file+offset+j*rowbytes, rowbytes);
+        header.imagedescriptor |= 0x20;
     } else if (10==header.datatypecode||11==header.datatypecode) {
-        if (!load_rle_data(in)) {
+        if (!load_rle_data(file+offset, filesize-offset)) {
             std::cerr << "an error occured while reading the data\n";
             return false;
         }
@@ -53,52 +72,47 @@ bool TGAImage::read_tga_file(const std::string &filename) {
     return true;
 }
 
-bool TGAImage::load_rle_data(std::ifstream &in) {
-    size_t pixelcount = w*h;
-    size_t currentpixel = 0;
-    size_t currentbyte  = 0;
-    TGAColor colorbuffer;
-    do {
-        std::uint8_t chunkheader = 0;
-        chunkheader = in.get();
-        if (!in.good()) {
+bool TGAImage::load_rle_data(const std::uint8_t *in, const size_t size) {
+    const std::uint8_t *end = in+size;
+    std::uint8_t *out = data.data();
+    std::uint8_t *const out_end = out+data.size();
+    while (out<out_end) {
+        if (in>=end) {
             std::cerr << "an error occured while reading the data\n";
             return false;
         }
+        const std::uint8_t chunkheader = *in++;
+        const size_t npixels = (chunkheader<128 ? chunkheader+1 : chunkheader-127);
+        const size_t nbytes = npixels*bpp;
+        if (nbytes>static_cast<size_t>(out_end-out)) {
+            std::cerr << "Too many pixels read\n";
+            return false;
+        }
         if (chunkheader<128) {
-            chunkheader++;
-            for (int i=0; i<chunkheader; i++) {
-                in.read(reinterpret_cast<char *>(colorbuffer.bgra), bpp);
-                if (!in.good()) {
-                    std::cerr << "an error occured while reading the header\n";
-                    return false;
-                }
-                for (int t=0; t<bpp; t++)
-                    data[currentbyte++] = colorbuffer.bgra[t];
-                currentpixel++;
-                if (currentpixel>pixelcount) {
-                    std::cerr << "Too many pixels read\n";
-                    return false;
-                }
+            // Raw packet: the pixels follow verbatim
+            if (nbytes>static_cast<size_t>(end-in)) {
+                std::cerr << "an error occured while reading the data\n";
+                return false;
             }
+            memcpy(out, in, nbytes);
+            in += nbytes;
         } else {
-            chunkheader -= 127;
-            in.read(reinterpret_cast<char *>(colorbuffer.bgra), bpp);
-            if (!in.good()) {
-                std::cerr << "an error occured while reading the header\n";
+            // Run packet: one pixel repeated, filled by doubling copies
+            if (static_cast<size_t>(bpp)>static_cast<size_t>(end-in)) {
+                std::cerr << "an error occured while reading the data\n";
                 return false;
             }
-            for (int i=0; i<chunkheader; i++) {
-                for (int t=0; t<bpp; t++)
-                    data[currentbyte++] = colorbuffer.bgra[t];
-                currentpixel++;
-                if (currentpixel>pixelcount) {
-                    std::cerr << "Too many pixels read\n";
-                    return false;
-                }
+            if (bpp==1) {
+                memset(out, *in, nbytes);
+            } else {
+                memcpy(out, in, bpp);
+                for (size_t filled=bpp; filled<nbytes; filled*=2)
+                    memcpy(out+filled, out, std::min(filled, nbytes-filled));
             }
+            in += bpp;
         }
-    } while (currentpixel < pixelcount);
+        out += nbytes;
+    }
     return true;
 }
 
@@ -106,50 +120,57 @@ bool TGAImage::write_tga_file(const std::string &filename, const bool vflip, con
     constexpr std::uint8_t developer_area_ref[4] = {0, 0, 0, 0};
     constexpr std::uint8_t extension_area_ref[4] = {0, 0, 0, 0};
     constexpr std::uint8_t footer[18] = {'T','R','U','E','V','I','S','I','O','N','-','X','F','I','L','E','.','\0'};
-    std::ofstream out;
-    out.open(filename, std::ios::binary);
-    if (!out.is_open()) {
-        std::cerr << "can't open file " << filename << "\n";
-        return false;
-    }
     TGAHeader header = {};
     header.bitsperpixel = bpp<<3;
     header.width  = w;
     header.height = h;
     header.datatypecode = (bpp==GRAYSCALE ? (rle?11:3) : (rle?10:2));
     header.imagedescriptor = vflip ? 0x00 : 0x20; // top-left or bottom-left origin
-    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
-    if (!out.good()) goto err;
-    if (!rle) {
-        out.write(reinterpret_cast<const char *>(data.data()), w*h*bpp);
-        if (!out.good()) goto err;
-    } else if (!unload_rle_data(out)) goto err;
-    out.write(reinterpret_cast<const char *>(developer_area_ref), sizeof(developer_area_ref));
-    if (!out.good()) goto err;
-    out.write(reinterpret_cast<const char *>(extension_area_ref), sizeof(extension_area_ref));
-    if (!out.good()) goto err;
-    out.write(reinterpret_cast<const char *>(footer), sizeof(footer));
-    if (!out.good()) goto err;
+
+    // The whole file is encoded into one buffer and written with a single call
+    std::vector<std::uint8_t> file;
+    file.reserve(sizeof(header) + data.size() + static_cast<size_t>(w)*h + sizeof(developer_area_ref) + sizeof(extension_area_ref) + sizeof(footer));
+    auto append = [&file](const void *p, const size_t n) {
+        const std::uint8_t *bytes = static_cast<const std::uint8_t *>(p);
+        file.insert(file.end(), bytes, bytes+n);
+    };
+    append(&header, sizeof(header));
+    if (!rle)
+        append(data.data(), w*h*bpp);
+    else
+        unload_rle_data(file);
+    append(developer_area_ref, sizeof(developer_area_ref));
+    append(extension_area_ref, sizeof(extension_area_ref));
+    append(footer, sizeof(footer));
+
+    std::ofstream out;
+    out.open(filename, std::ios::binary);
+    if (!out.is_open()) {
+        std::cerr << "can't open file " << filename << "\n";
+        return false;
+    }
+    out.write(reinterpret_cast<const char *>(file.data()), static_cast<std::streamsize>(file.size()));
+    if (!out.good()) {
+        std::cerr << "can't dump the tga file\n";
+        return false;
+    }
     return true;
-err:
-    std::cerr << "can't dump the tga file\n";
-    return false;
 }
 
-bool TGAImage::unload_rle_data(std::ofstream &out) const {
+// Packets are split exactly as the byte-by-byte encoder did; pixels are compared with a fixed-size
+// memcmp, which compiles to one or two loads per pixel.
+template<int BPP>
+static std::uint8_t *encode_rle(const std::uint8_t *data, const size_t npixels, std::uint8_t *out) {
     const std::uint8_t max_chunk_length = 128;
-    size_t npixels = w*h;
     size_t curpix = 0;
     while (curpix<npixels) {
-        size_t chunkstart = curpix*bpp;
-        size_t curbyte = curpix*bpp;
+        const std::uint8_t *chunkstart = data+curpix*BPP;
+        const std::uint8_t *cur = chunkstart;
         std::uint8_t run_length = 1;
         bool raw = true;
         while (curpix+run_length<npixels && run_length<max_chunk_length) {
-            bool succ_eq = true;
-            for (int t=0; succ_eq && t<bpp; t++)
-                succ_eq = (data[curbyte+t]==data[curbyte+t+bpp]);
-            curbyte += bpp;
+            const bool succ_eq = !memcmp(cur, cur+BPP, BPP);
+            cur += BPP;
             if (1==run_length)
                 raw = !succ_eq;
             if (raw && succ_eq) {
@@ -161,12 +182,26 @@ bool TGAImage::unload_rle_data(std::ofstream &out) const {
             run_length++;
         }
         curpix += run_length;
-        out.put(raw ? run_length-1 : run_length+127);
-        if (!out.good()) return false;
-        out.write(reinterpret_cast<const char *>(data.data()+chunkstart), (raw?run_length*bpp:bpp));
-        if (!out.good()) return false;
+        *out++ = raw ? run_length-1 : run_length+127;
+        const size_t nbytes = raw ? run_length*BPP : BPP;
+        memcpy(out, chunkstart, nbytes);
+        out += nbytes;
     }
-    return true;
+    return out;
+}
+
+void TGAImage::unload_rle_data(std::vector<std::uint8_t> &out) const {
+    // Worst case: a header for every pixel, e.g. single raw pixels alternating with runs of two
+    const size_t npixels = static_cast<size_t>(w)*h;
+    const size_t start = out.size();
+    out.resize(start + data.size() + npixels);
+    std::uint8_t *end = out.data()+start;
+    switch (bpp) {
+        case GRAYSCALE: end = encode_rle<GRAYSCALE>(data.data(), npixels, end); break;
+        case RGB:       end = encode_rle<RGB>(data.data(), npixels, end); break;
+        case RGBA:      end = encode_rle<RGBA>(data.data(), npixels, end); break;
+    }
+    out.resize(end-out.data());
 }
 
 TGAColor TGAImage::get(const int x, const int y) const {
@@ -183,17 +218,17 @@ void TGAImage::set(int x, int y, const TGAColor &c) {
 }
 
 void TGAImage::flip_horizontally() {
-    for (int i=0; i<w/2; i++)
-        for (int j=0; j<h; j++)
-            for (int b=0; b<bpp; b++)
-                std::swap(data[(i+j*w)*bpp+b], data[(w-1-i+j*w)*bpp+b]);
+    for (int j=0; j<h; j++) {
+        std::uint8_t *row = data.data()+j*w*bpp;
+        for (int i=0; i<w/2; i++)
+            std::swap_ranges(row+i*bpp, row+(i+1)*bpp, row+(w-1-i)*bpp);
+    }
 }
 
 void TGAImage::flip_vertically() {
-    for (int i=0; i<w; i++)
-        for (int j=0; j<h/2; j++)
-            for (int b=0; b<bpp; b++)
-                std::swap(data[(i+j*w)*bpp+b], data[(i+(h-1-j)*w)*bpp+b]);
+    const size_t rowbytes = w*bpp;
+    for (int j=0; j<h/2; j++)
+        std::swap_ranges(data.begin()+j*rowbytes, data.begin()+(j+1)*rowbytes, data.begin()+(h-1-j)*rowbytes);
 }
 
 int TGAImage::width() const {
@@ -204,3 +239,11 @@ int TGAImage::height() const {
     return h;
 }
 
+int TGAImage::bytespp() const {
+    return bpp;
+}
+
+const std::uint8_t *TGAImage::row(const int y) const {
+    return data.data() + static_cast<size_t>(y) * w * bpp;
+}
+